@@ -0,0 +1,229 @@
+#include "benchmark.h"
+#include "texture.h"
+#include "tgaimage.h"
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+#define BENCH_SCREEN 512
+#define BENCH_REPEAT 4
+
+// the Texture fetch with each mip level in rows of width texels instead of tiles
+typedef struct
+{
+	typedef struct
+	{
+		int width, height;
+		std::vector<uint8_t> texels;
+	} level_t;
+	std::vector<level_t> levels;
+
+	const uint8_t* texel(Vec2 uv, int level) const
+	{
+		const level_t& m = levels[level];
+		float fu = uv.x * (float)m.width, fv = uv.y * (float)m.height;
+		int x = (int)fu, y = (int)fv;
+		x = (x - (fu < (float)x)) & (m.width - 1);
+		y = (y - (fv < (float)y)) & (m.height - 1);
+		return &m.texels[((size_t)y * m.width + x) * 4];
+	}
+} linear_texture_t;
+
+// walk a BENCH_SCREEN square screen whose uv axes are rotated by angle and scaled by scale base
+// texels per pixel, fetching from the mip level the renderer would pick for that scale.
+// Returns the best time of BENCH_REPEAT runs in ms
+template<typename T>
+static double walk_screen(const T& tex, int width, int height, float angle, float scale, int level, unsigned& sum)
+{
+	float c = cosf(angle) * scale, s = sinf(angle) * scale;
+	Vec2 du(c / width, s / height), dv(-s / width, c / height);
+	double best = 1e30;
+	for (int r = 0; r < BENCH_REPEAT; r++)
+	{
+		auto t0 = std::chrono::steady_clock::now();
+		for (int y = 0; y < BENCH_SCREEN; y++)
+		{
+			Vec2 uv(dv.x * y, dv.y * y);
+			for (int x = 0; x < BENCH_SCREEN; x++)
+			{
+				sum += tex.texel(uv, level)[0];
+				uv = uv + du;
+			}
+		}
+		double ms = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() * 1000;
+		if (ms < best)
+			best = ms;
+	}
+	return best;
+}
+
+void texture_benchmark(const char* filename)
+{
+	Texture* tex = Texture::from_file(filename, true);
+	Texture* bc1 = Texture::from_file(filename, true, TEXTURE_BC1);
+	int width = tex->get_width(), height = tex->get_height();
+
+	linear_texture_t linear;
+	linear.levels.resize(tex->mip_levels());
+	for (int level = 0; level < tex->mip_levels(); level++)
+	{
+		linear_texture_t::level_t& m = linear.levels[level];
+		m.width = width >> level > 0 ? width >> level : 1;
+		m.height = height >> level > 0 ? height >> level : 1;
+		m.texels.resize((size_t)m.width * m.height * 4);
+		for (int y = 0; y < m.height; y++)
+			for (int x = 0; x < m.width; x++)
+			{
+				texel_t t = tex->texel_at(x, y, level);
+				for (int i = 0; i < 4; i++)
+					m.texels[((size_t)y * m.width + x) * 4 + i] = t[i];
+			}
+	}
+
+	std::cout << "texture " << filename << " " << width << "x" << height << ", "
+		<< BENCH_SCREEN << "x" << BENCH_SCREEN << " fetches, " << tex->memory_size() / 1024 << " KB tiled, "
+		<< bc1->memory_size() / 1024 << " KB bc1\n";
+
+	const float angles[] = { 0, 30, 45, 90 };
+	const float scales[] = { 1, 4, 16 };
+	unsigned sum = 0;
+	for (float scale : scales)
+		for (float angle : angles)
+		{
+			float a = angle * 3.14159265f / 180;
+			int level = tex->mip_level(log2f(scale) - log2f((float)(std::max)(width, height)));
+			double ms_linear = walk_screen(linear, width, height, a, scale, level, sum);
+			double ms_tiled = walk_screen(*tex, width, height, a, scale, level, sum);
+			double ms_bc1 = walk_screen(*bc1, width, height, a, scale, level, sum);
+			std::cout << "angle " << angle << " scale " << scale << " level " << level << ": linear " << ms_linear
+				<< " ms, tiled " << ms_tiled << " ms, bc1 " << ms_bc1 << " ms\n";
+		}
+	std::cout << "checksum " << sum << "\n";
+	delete tex;
+	delete bc1;
+}
+
+// the stream reader read_tga_file replaced, for tga_benchmark
+typedef struct
+{
+	int width, height, bytespp;
+	std::vector<unsigned char> data;
+} legacy_image_t;
+
+static void legacy_flip_vertically(legacy_image_t& img)
+{
+	size_t bytes_per_line = (size_t)img.width * img.bytespp;
+	std::vector<unsigned char> line(bytes_per_line);
+	for (int j = 0; j < img.height / 2; j++)
+	{
+		unsigned char* l1 = &img.data[j * bytes_per_line];
+		unsigned char* l2 = &img.data[(img.height - 1 - j) * bytes_per_line];
+		memmove(line.data(), l1, bytes_per_line);
+		memmove(l1, l2, bytes_per_line);
+		memmove(l2, line.data(), bytes_per_line);
+	}
+}
+
+static bool legacy_load_rle(std::ifstream& in, legacy_image_t& img)
+{
+	size_t pixelcount = (size_t)img.width * img.height, currentpixel = 0, currentbyte = 0;
+	TGAColor colorbuffer;
+	do
+	{
+		int chunkheader = in.get();
+		if (!in.good())
+			return false;
+		bool run = chunkheader >= 128;
+		int count = run ? chunkheader - 127 : chunkheader + 1;
+		if (run)
+			in.read((char*)colorbuffer.raw, img.bytespp);
+		for (int i = 0; i < count; i++)
+		{
+			if (!run)
+				in.read((char*)colorbuffer.raw, img.bytespp);
+			if (!in.good() || ++currentpixel > pixelcount)
+				return false;
+			for (int t = 0; t < img.bytespp; t++)
+				img.data[currentbyte++] = colorbuffer.raw[t];
+		}
+	} while (currentpixel < pixelcount);
+	return true;
+}
+
+// read, flip to top-first by the descriptor, then flip again to bottom-up as the loaders did
+static bool legacy_read_tga(const char* filename, legacy_image_t& img)
+{
+	std::ifstream in(filename, std::ios::binary);
+	TGA_Header header;
+	in.read((char*)&header, sizeof(header));
+	if (!in.good())
+		return false;
+	img.width = header.width;
+	img.height = header.height;
+	img.bytespp = header.bitsperpixel >> 3;
+	img.data.assign((size_t)img.width * img.height * img.bytespp, 0);
+	bool ok = false;
+	if (header.datatypecode == 2 || header.datatypecode == 3)
+		ok = (bool)in.read((char*)img.data.data(), img.data.size());
+	else if (header.datatypecode == 10 || header.datatypecode == 11)
+		ok = legacy_load_rle(in, img);
+	if (!ok)
+		return false;
+	if (!(header.imagedescriptor & 0x20))
+		legacy_flip_vertically(img);
+	std::cerr << (std::to_string(img.width) + "x" + std::to_string(img.height) + "/" + std::to_string(img.bytespp * 8) + "\n");
+	legacy_flip_vertically(img);
+	return true;
+}
+
+// best time of BENCH_REPEAT decodes in ms
+template<typename F>
+static double best_of(F decode)
+{
+	double best = 1e30;
+	for (int r = 0; r < BENCH_REPEAT; r++)
+	{
+		auto t0 = std::chrono::steady_clock::now();
+		decode();
+		double ms = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count() * 1000;
+		if (ms < best)
+			best = ms;
+	}
+	return best;
+}
+
+void tga_benchmark(const char* filename)
+{
+	TGAImage source;
+	if (!source.read_tga_file(filename))
+		return;
+	const char* raw_copy = "tga_bench_raw.tga";
+	const char* rle_copy = "tga_bench_rle.tga";
+	source.write_tga_file(raw_copy, false);
+	source.write_tga_file(rle_copy, true);
+
+	const char* files[3] = { filename, raw_copy, rle_copy };
+	const char* names[3] = { "as given", "raw", "rle" };
+	double mb = (double)source.get_width() * source.get_height() * source.get_bytespp() / (1024 * 1024);
+	std::cout << "tga " << filename << " " << source.get_width() << "x" << source.get_height() << "/"
+		<< source.get_bytespp() * 8 << ", " << mb << " MB decoded per read\n";
+	for (int i = 0; i < 3; i++)
+	{
+		// fresh images every time, both pay for touching a new buffer
+		legacy_image_t old_image;
+		TGAImage new_image;
+		double ms_old = best_of([&]() { old_image = legacy_image_t(); legacy_read_tga(files[i], old_image); });
+		double ms_new = best_of([&]() { new_image = TGAImage(); new_image.read_tga_file(files[i], true); });
+		bool same = new_image.buffer() && old_image.data.size() == (size_t)new_image.get_width() * new_image.get_height() * new_image.get_bytespp() &&
+			memcmp(old_image.data.data(), new_image.buffer(), old_image.data.size()) == 0;
+		std::cout << names[i] << ": stream " << ms_old << " ms (" << mb / ms_old * 1000 << " MB/s), mapped "
+			<< ms_new << " ms (" << mb / ms_new * 1000 << " MB/s), " << (same ? "same rows" : "ROWS DIFFER") << "\n";
+	}
+	remove(raw_copy);
+	remove(rle_copy);
+}
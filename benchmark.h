@@ -0,0 +1,11 @@
+#pragma once
+
+// nearest sampling of a mipmapped texture file through the tiled Texture, against the same texels in
+// linear rows and as BC1 blocks, over a screen of rotated and minified uv walks. Timings and
+// resident sizes go to stdout
+void texture_benchmark(const char* filename);
+
+// decode throughput of read_tga_file against the previous stream reader (pixel by pixel RLE through
+// std::ifstream, then flipped into place), both producing the bottom-up rows Texture loads from.
+// Runs on the file as given and on raw and RLE copies of it. Timings go to stdout
+void tga_benchmark(const char* filename);
@@ -0,0 +1,242 @@
+#include "bundle.h"
+#include <fstream>
+#include <iostream>
+#include <cstring>
+
+static_assert(sizeof(Vec3) == 3 * sizeof(float) && sizeof(Vec2) == 2 * sizeof(float), "bundle arrays are stored as raw Vec2 / Vec3");
+
+// offsets are in bytes from the start of the file, a width of 0 is a missing map
+typedef struct
+{
+	int32_t width, height, mipmaps, format;
+	uint64_t offset, size;
+} rpak_texture_t;
+
+typedef struct
+{
+	int32_t levels;
+	int32_t sizes[RPAK_MAX_LEVELS];
+	uint64_t offset, size;
+} rpak_cubemap_t;
+
+enum { RPAK_DIFFUSE, RPAK_NORMAL, RPAK_SPECULAR, RPAK_MATERIAL, RPAK_EMISSION, RPAK_MAPS };
+
+typedef struct
+{
+	char magic[4]; // "RPAK"
+	int32_t version;
+	uint64_t file_size;
+
+	int32_t n_verts, n_indices;
+	uint64_t verts, uvs, norms, indices;
+	rpak_texture_t maps[RPAK_MAPS];
+	int32_t has_occlusion;
+
+	int32_t mip_levels;
+	float irradiance_sh[9 * 3];
+	rpak_cubemap_t irradiance, prefilter;
+	rpak_texture_t brdf_lut;
+} rpak_header_t;
+
+// the arrays are written after the header, each one padded to RPAK_ALIGN
+class bundle_writer
+{
+public:
+	explicit bundle_writer(const char* filename) : out(filename, std::ios::binary), pos(0) {}
+
+	bool good() const { return out.good(); }
+	uint64_t size() const { return pos; }
+
+	uint64_t put(const void* data, size_t size)
+	{
+		static const char zero[RPAK_ALIGN] = {};
+		size_t pad = (size_t)(0 - pos) & (RPAK_ALIGN - 1);
+		out.write(zero, pad);
+		uint64_t at = pos + pad;
+		out.write((const char*)data, size);
+		pos = at + size;
+		return at;
+	}
+
+	void put_texture(const Texture* t, rpak_texture_t& d)
+	{
+		memset(&d, 0, sizeof(d));
+		if (!t)
+			return;
+		d.width = t->get_width();
+		d.height = t->get_height();
+		d.mipmaps = t->mip_levels() > 1;
+		d.format = t->get_format();
+		d.size = t->memory_size();
+		d.offset = put(t->texel_data(), t->memory_size());
+	}
+
+	void put_cubemap(const Cubemap* c, rpak_cubemap_t& d)
+	{
+		memset(&d, 0, sizeof(d));
+		d.levels = c->mip_levels();
+		for (int m = 0; m < d.levels; m++)
+			d.sizes[m] = c->face_size(m);
+		d.size = c->memory_size();
+		d.offset = put(c->texel_data(), c->memory_size());
+	}
+
+	void put_header(const rpak_header_t& h)
+	{
+		out.seekp(0);
+		out.write((const char*)&h, sizeof(h));
+	}
+
+private:
+	std::ofstream out;
+	uint64_t pos;
+};
+
+bool write_bundle(const char* filename, const Model& model, const iblmap_t& iblmap)
+{
+	if (iblmap.irradiance_map->mip_levels() > RPAK_MAX_LEVELS || iblmap.prefilter_map->mip_levels() > RPAK_MAX_LEVELS)
+		return false;
+
+	bundle_writer out(filename);
+	rpak_header_t h;
+	memset(&h, 0, sizeof(h));
+	out.put(&h, sizeof(h));
+
+	h.n_verts = model.n_verts();
+	h.n_indices = model.n_faces() * 3;
+	h.verts = out.put(model.vertices(), (size_t)h.n_verts * sizeof(Vec3));
+	h.uvs = out.put(model.texcoords(), (size_t)h.n_verts * sizeof(Vec2));
+	h.norms = out.put(model.normals(), (size_t)h.n_verts * sizeof(Vec3));
+	h.indices = out.put(model.face_indices(), (size_t)h.n_indices * sizeof(uint32_t));
+	out.put_texture(model.diffusemap_, h.maps[RPAK_DIFFUSE]);
+	out.put_texture(model.normalmap_, h.maps[RPAK_NORMAL]);
+	out.put_texture(model.specularmap_, h.maps[RPAK_SPECULAR]);
+	out.put_texture(model.material_map, h.maps[RPAK_MATERIAL]);
+	out.put_texture(model.emision_map, h.maps[RPAK_EMISSION]);
+	h.has_occlusion = model.has_occlusion;
+
+	h.mip_levels = iblmap.mip_levels;
+	memcpy(h.irradiance_sh, iblmap.irradiance_sh, sizeof(h.irradiance_sh));
+	out.put_cubemap(iblmap.irradiance_map, h.irradiance);
+	out.put_cubemap(iblmap.prefilter_map, h.prefilter);
+	out.put_texture(iblmap.brdf_lut, h.brdf_lut);
+
+	memcpy(h.magic, "RPAK", 4);
+	h.version = RPAK_VERSION;
+	h.file_size = out.size();
+	out.put_header(h);
+	return out.good();
+}
+
+Bundle::Bundle() : model(nullptr), iblmap(nullptr)
+{
+}
+
+Bundle::~Bundle()
+{
+	close();
+}
+
+void Bundle::close()
+{
+	delete model;
+	if (iblmap) {
+		delete iblmap->irradiance_map;
+		delete iblmap->prefilter_map;
+		delete iblmap->brdf_lut;
+		delete iblmap;
+	}
+	model = nullptr;
+	iblmap = nullptr;
+	file.close();
+}
+
+// the views check their own sizes, the bundle that the ranges are inside the file and aligned
+static bool in_file(const MappedFile& file, uint64_t offset, uint64_t size)
+{
+	return !(offset & (RPAK_ALIGN - 1)) && offset <= file.size() && size <= file.size() - offset;
+}
+
+// every index names a vertex, so the vertex stage stays inside the mapping
+static bool indices_valid(const uint32_t* indices, int n_indices, int n_verts)
+{
+	uint32_t bad = 0;
+	for (int i = 0; i < n_indices; i++)
+		bad |= indices[i] >= (uint32_t)n_verts;
+	return !bad;
+}
+
+// true for a missing map too, which leaves t nullptr
+static bool view_texture(const MappedFile& file, const rpak_texture_t& d, Texture*& t)
+{
+	t = nullptr;
+	if (d.width == 0)
+		return true;
+	if (d.format < TEXTURE_RGBA8 || d.format > TEXTURE_BC5 || !in_file(file, d.offset, d.size))
+		return false;
+	t = Texture::view(d.width, d.height, d.mipmaps != 0, (texture_format)d.format,
+		(const uint8_t*)file.data() + d.offset, (size_t)d.size);
+	return t != nullptr;
+}
+
+static Cubemap* view_cubemap(const MappedFile& file, const rpak_cubemap_t& d)
+{
+	if (d.levels <= 0 || d.levels > RPAK_MAX_LEVELS || !in_file(file, d.offset, d.size))
+		return nullptr;
+	Cubemap* c = Cubemap::view(d.sizes, d.levels, (const uint32_t*)(file.data() + d.offset));
+	if (c && c->memory_size() != d.size) {
+		delete c;
+		return nullptr;
+	}
+	return c;
+}
+
+bool Bundle::open(const char* filename)
+{
+	close();
+	if (!file.open(filename) || file.size() < sizeof(rpak_header_t))
+		return false;
+	const rpak_header_t& h = *(const rpak_header_t*)file.data();
+	if (memcmp(h.magic, "RPAK", 4) != 0 || h.version != RPAK_VERSION || h.file_size != file.size() ||
+		h.n_verts < 0 || h.n_indices < 0 || h.n_indices % 3 != 0 || h.mip_levels <= 0 ||
+		!in_file(file, h.verts, (uint64_t)h.n_verts * sizeof(Vec3)) ||
+		!in_file(file, h.uvs, (uint64_t)h.n_verts * sizeof(Vec2)) ||
+		!in_file(file, h.norms, (uint64_t)h.n_verts * sizeof(Vec3)) ||
+		!in_file(file, h.indices, (uint64_t)h.n_indices * sizeof(uint32_t)) ||
+		!indices_valid((const uint32_t*)(file.data() + h.indices), h.n_indices, h.n_verts)) {
+		std::cerr << "bundle " << filename << " is corrupt\n";
+		file.close();
+		return false;
+	}
+
+	model_view_t v;
+	v.n_verts = h.n_verts;
+	v.n_indices = h.n_indices;
+	v.verts = (const Vec3*)(file.data() + h.verts);
+	v.uvs = (const Vec2*)(file.data() + h.uvs);
+	v.norms = (const Vec3*)(file.data() + h.norms);
+	v.indices = (const uint32_t*)(file.data() + h.indices);
+	v.has_occlusion = h.has_occlusion != 0;
+	bool ok = view_texture(file, h.maps[RPAK_DIFFUSE], v.diffuse);
+	ok = view_texture(file, h.maps[RPAK_NORMAL], v.normal) && ok;
+	ok = view_texture(file, h.maps[RPAK_SPECULAR], v.specular) && ok;
+	ok = view_texture(file, h.maps[RPAK_MATERIAL], v.material) && ok;
+	ok = view_texture(file, h.maps[RPAK_EMISSION], v.emission) && ok;
+	model = new Model(v);
+
+	iblmap = new iblmap_t();
+	iblmap->mip_levels = h.mip_levels;
+	memcpy(iblmap->irradiance_sh, h.irradiance_sh, sizeof(h.irradiance_sh));
+	iblmap->irradiance_map = view_cubemap(file, h.irradiance);
+	iblmap->prefilter_map = view_cubemap(file, h.prefilter);
+	ok = view_texture(file, h.brdf_lut, iblmap->brdf_lut) && ok;
+	ok = ok && iblmap->irradiance_map && iblmap->prefilter_map && iblmap->brdf_lut &&
+		iblmap->prefilter_map->mip_levels() >= h.mip_levels;
+
+	if (!ok) {
+		std::cerr << "bundle " << filename << " is corrupt\n";
+		close();
+		return false;
+	}
+	return true;
+}
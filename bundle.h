@@ -0,0 +1,42 @@
+#pragma once
+#include "graphic.h"
+#include "model.h"
+#include "mapped_file.h"
+
+// .rpak bundle: the vertex and index arrays of a model, its decoded maps and the IBL maps of one
+// environment, in the in-memory layout of Model, Texture and Cubemap. Every array starts on a
+// RPAK_ALIGN boundary, so a read-only mapping of the file is used in place: opening a bundle
+// parses nothing, the pages are read on first touch and shared by every process mapping it.
+// Native byte order and struct layout, a bundle is read by the build that wrote it.
+#define RPAK_VERSION 2
+#define RPAK_ALIGN 64
+#define RPAK_MAX_LEVELS 16
+
+// write the loaded model (its maps finished, see Model::wait_maps) and IBL maps to filename
+bool write_bundle(const char* filename, const Model& model, const iblmap_t& iblmap);
+
+// a mapped bundle and the Model and iblmap_t over it, which are valid while it is open
+class Bundle
+{
+public:
+	Bundle();
+	~Bundle();
+
+	// false when the file is missing, truncated, of another version or inconsistent: misaligned
+	// arrays, indices past the vertices, no IBL levels, unknown texture formats or cubemap sizes
+	// that are not halving powers of two
+	bool open(const char* filename);
+	void close();
+	bool is_open() const { return model != nullptr; }
+
+	Model* get_model() const { return model; }
+	iblmap_t* get_iblmap() const { return iblmap; }
+
+private:
+	Bundle(const Bundle&);
+	Bundle& operator=(const Bundle&);
+
+	MappedFile file;
+	Model* model;
+	iblmap_t* iblmap;
+};
@@ -0,0 +1,189 @@
+#include "cubemap.h"
+#include "sample.h"
+#include <algorithm>
+
+static uint32_t pack_texel(texel_t t)
+{
+	return t[0] | t[1] << 8 | t[2] << 16 | (uint32_t)t[3] << 24;
+}
+
+Cubemap::Cubemap() : texels(nullptr)
+{
+}
+
+// level-major, 6 faces per level, a face smaller than a tile takes a whole one. Returns the texel count
+size_t Cubemap::lay_out(const int* sizes, int count)
+{
+	size_t total = 0;
+	for (int m = 0; m < count; m++) {
+		level_t l;
+		l.size = sizes[m];
+		l.fsize = (float)sizes[m];
+		l.span = std::max(sizes[m], TEXTURE_TILE);
+		l.offset = total;
+		levels.push_back(l);
+		total += (size_t)6 * l.span * l.span;
+	}
+	return total;
+}
+
+uint32_t* Cubemap::allocate(const int* sizes, int count)
+{
+	size_t total = lay_out(sizes, count);
+	storage.resize(total * 4 + CUBEMAP_ALIGN);
+	uintptr_t p = (uintptr_t)storage.data();
+	uint32_t* aligned = (uint32_t*)((p + CUBEMAP_ALIGN - 1) & ~(uintptr_t)(CUBEMAP_ALIGN - 1));
+	texels = aligned;
+	return aligned;
+}
+
+Cubemap* Cubemap::view(const int* sizes, int count, const uint32_t* texels)
+{
+	// the lookups wrap with size - 1 as a mask
+	for (int m = 0; m < count; m++)
+		if (sizes[m] <= 0 || (sizes[m] & (sizes[m] - 1)) || (m > 0 && sizes[m] != std::max(sizes[m - 1] >> 1, 1)))
+			return nullptr;
+	Cubemap* cube = new Cubemap();
+	cube->lay_out(sizes, count);
+	cube->texels = texels;
+	return cube;
+}
+
+size_t Cubemap::memory_size() const
+{
+	const level_t& l = levels.back();
+	return (l.offset + (size_t)6 * l.span * l.span) * 4;
+}
+
+Cubemap::Cubemap(const Texture* const* faces, int count) : texels(nullptr)
+{
+	std::vector<int> sizes(count);
+	for (int m = 0; m < count; m++)
+		sizes[m] = std::min(faces[m * 6]->get_width(), faces[m * 6]->get_height());
+	uint32_t* out = allocate(sizes.data(), count);
+
+	for (int m = 0; m < count; m++) {
+		const level_t& l = levels[m];
+		for (int f = 0; f < 6; f++)
+			for (int y = 0; y < l.size; y++)
+				for (int x = 0; x < l.size; x++)
+					out[texel_index(l, f, x, y)] = pack_texel(faces[m * 6 + f]->texel_at(x, y));
+	}
+}
+
+Cubemap* Cubemap::from_face_mips(const Texture* const* faces)
+{
+	Cubemap* cube = new Cubemap();
+	int base = std::min(faces[0]->get_width(), faces[0]->get_height());
+	std::vector<int> sizes;
+	for (int m = 0; m < faces[0]->mip_levels(); m++)
+		sizes.push_back(std::max(base >> m, 1));
+	uint32_t* out = cube->allocate(sizes.data(), (int)sizes.size());
+
+	for (int m = 0; m < cube->mip_levels(); m++) {
+		const level_t& l = cube->levels[m];
+		for (int f = 0; f < 6; f++)
+			for (int y = 0; y < l.size; y++)
+				for (int x = 0; x < l.size; x++)
+					out[texel_index(l, f, x, y)] = pack_texel(faces[f]->texel_at(x, y, m));
+	}
+	return cube;
+}
+
+texel_t Cubemap::texel_at(int face, int x, int y, int level) const
+{
+	const level_t& l = levels[level];
+	uint32_t v = texels[texel_index(l, face, x, y)];
+	texel_t t;
+	for (int c = 0; c < 4; c++)
+		t.c[c] = (uint8_t)(v >> (8 * c));
+	return t;
+}
+
+Vec3 Cubemap::sample(Vec3 direction, int level) const
+{
+	Vec2 uv;
+	int face = cal_cubemap_uv(direction, uv);
+	const level_t& l = levels[level];
+	int x = (int)floorf(uv.x * l.fsize) & (l.size - 1);
+	int y = (int)floorf(uv.y * l.fsize) & (l.size - 1);
+	uint32_t t = texels[texel_index(l, face, x, y)];
+	return Vec3(Texture::unorm8[t & 255], Texture::unorm8[t >> 8 & 255], Texture::unorm8[t >> 16 & 255]);
+}
+
+Vec3x8 Cubemap::sample8(const Vec3x8& d, const int* level) const
+{
+	// the tests of cal_cubemap_uv as lane masks: start from the z major faces and let y, then x
+	// take over the lanes where they are the major axis
+	float8 zero(0.f);
+	float8 ax = abs8(d.x), ay = abs8(d.y), az = abs8(d.z);
+
+	float8 z_pos = greater8(d.z, zero);
+	float8 face = select8(z_pos, float8(4.f), float8(5.f));
+	float8 sc = select8(z_pos, zero - d.x, d.x);
+	float8 tc = d.y;
+	float8 ma = az;
+
+	float8 y_major = greater8(ay, az);
+	float8 y_pos = greater8(d.y, zero);
+	face = select8(y_major, select8(y_pos, float8(2.f), float8(3.f)), face);
+	sc = select8(y_major, d.x, sc);
+	tc = select8(y_major, select8(y_pos, d.z, zero - d.z), tc);
+	ma = select8(y_major, ay, ma);
+
+	float8 x_over_y = greater8(ax, ay), x_over_z = greater8(ax, az);
+	float8 x_pos = greater8(d.x, zero);
+	face = select8(x_over_y, select8(x_over_z, select8(x_pos, zero, float8(1.f)), face), face);
+	sc = select8(x_over_y, select8(x_over_z, select8(x_pos, d.z, zero - d.z), sc), sc);
+	tc = select8(x_over_y, select8(x_over_z, d.y, tc), tc);
+	ma = select8(x_over_y, select8(x_over_z, ax, ma), ma);
+
+	float8 u = (sc / ma + 1.f) / 2.f;
+	float8 v = (tc / ma + 1.f) / 2.f;
+
+	float size_l[8];
+	for (int l = 0; l < 8; l++)
+		size_l[l] = levels[level[l]].fsize;
+	float8 fsize = float8::load(size_l);
+	float8 fx = floor8(u * fsize), fy = floor8(v * fsize);
+
+#if defined(USE_AVX2)
+	int offset_l[8];
+	for (int l = 0; l < 8; l++)
+		offset_l[l] = (int)levels[level[l]].offset;
+	// texel_index in int lanes, then one gather over the whole allocation
+	__m256i size = _mm256_cvttps_epi32(fsize.v);
+	__m256i wrap = _mm256_sub_epi32(size, _mm256_set1_epi32(1));
+	__m256i x = _mm256_and_si256(_mm256_cvttps_epi32(fx.v), wrap);
+	__m256i y = _mm256_and_si256(_mm256_cvttps_epi32(fy.v), wrap);
+	__m256i inner = _mm256_set1_epi32(TEXTURE_TILE - 1);
+	__m256i span = _mm256_max_epi32(size, _mm256_set1_epi32(TEXTURE_TILE));
+	__m256i row = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_cvttps_epi32(face.v), span), _mm256_andnot_si256(inner, y));
+	__m256i in_row = _mm256_or_si256(_mm256_andnot_si256(inner, x), _mm256_and_si256(y, inner));
+	__m256i index = _mm256_add_epi32(_mm256_add_epi32(_mm256_loadu_si256((const __m256i*)offset_l), _mm256_mullo_epi32(row, span)),
+		_mm256_add_epi32(_mm256_slli_epi32(in_row, TEXTURE_TILE_SHIFT), _mm256_and_si256(x, inner)));
+	__m256i t = _mm256_i32gather_epi32((const int*)texels, index, 4);
+
+	__m256i byte = _mm256_set1_epi32(255);
+	__m256 scale = _mm256_set1_ps(255.f);
+	float8 r = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_and_si256(t, byte)), scale);
+	float8 g = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(t, 8), byte)), scale);
+	float8 b = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(t, 16), byte)), scale);
+	return Vec3x8(r, g, b);
+#else
+	float face_l[8], x_l[8], y_l[8], r[8], g[8], b[8];
+	face.store(face_l);
+	fx.store(x_l);
+	fy.store(y_l);
+	for (int l = 0; l < 8; l++) {
+		// u == 1 wraps to texel 0, and so do the NaN of a dead lane
+		int x = x_l[l] >= 0 && x_l[l] < size_l[l] ? (int)x_l[l] : 0;
+		int y = y_l[l] >= 0 && y_l[l] < size_l[l] ? (int)y_l[l] : 0;
+		uint32_t t = texels[texel_index(levels[level[l]], (int)face_l[l], x, y)];
+		r[l] = Texture::unorm8[t & 255];
+		g[l] = Texture::unorm8[t >> 8 & 255];
+		b[l] = Texture::unorm8[t >> 16 & 255];
+	}
+	return Vec3x8(float8::load(r), float8::load(g), float8::load(b));
+#endif
+}
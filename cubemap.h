@@ -0,0 +1,66 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include "texture.h"
+#include "simd.h"
+
+// alignment of the texel allocation, one cache line
+#define CUBEMAP_ALIGN 64
+
+// six square faces and their whole mip chain in one aligned allocation of RGBA8 texels, faces in
+// the order +x, -x, +y, -y, +z, -z, each one in the 4x4 tiles Texture uses with v = 0 in the first
+// tile row. Texel (x, y) of face f at level m is texels[level_offset(m) + f * face_stride(m) +
+// tiled(x, y)], so a batch of lookups still becomes one gather. Faces are sampled nearest and wrap
+// like Texture does, sizes are powers of two.
+class Cubemap
+{
+public:
+	// faces[m * 6 + f] is face f of level m, read from its texture's base level
+	Cubemap(const Texture* const* faces, int levels);
+	// level m of every face is level m of its texture's mip chain
+	static Cubemap* from_face_mips(const Texture* const* faces);
+	// a cubemap over texels laid out like texel_data() of one with these level sizes, which are not
+	// copied and must outlive it. nullptr unless the sizes are powers of two halving per level
+	static Cubemap* view(const int* sizes, int levels, const uint32_t* texels);
+
+	int mip_levels() const { return (int)levels.size(); }
+	int face_size(int level) const { return levels[level].size; }
+	texel_t texel_at(int face, int x, int y, int level = 0) const;
+	// the texels of all levels, memory_size() bytes
+	const uint32_t* texel_data() const { return texels; }
+	size_t memory_size() const;
+
+	// nearest texel along a direction, r, g, b as 0 ~ 1
+	Vec3 sample(Vec3 direction, int level = 0) const;
+	// 8 directions at once, level[l] for lane l, face selection branch-free in float8 lanes
+	Vec3x8 sample8(const Vec3x8& direction, const int* level) const;
+
+private:
+	Cubemap();
+	Cubemap(const Cubemap&);
+	Cubemap& operator=(const Cubemap&);
+
+	typedef struct
+	{
+		int size;
+		float fsize;
+		int span; // size rounded up to a whole tile, a face is span * span texels
+		size_t offset; // first texel of face 0 in texels
+	} level_t;
+
+	// Texture's tiled index: span rows of tiles hold TEXTURE_TILE texel rows each, and the tile of
+	// column x starts at (x & ~3) * TEXTURE_TILE within them
+	static size_t texel_index(const level_t& l, int face, int x, int y)
+	{
+		const int inner = TEXTURE_TILE - 1;
+		size_t row = (size_t)face * l.span + (y & ~inner);
+		return l.offset + row * l.span + (((x & ~inner) | (y & inner)) << TEXTURE_TILE_SHIFT) + (x & inner);
+	}
+
+	size_t lay_out(const int* sizes, int count);
+	uint32_t* allocate(const int* sizes, int count);
+
+	std::vector<level_t> levels;
+	std::vector<uint8_t> storage;
+	const uint32_t* texels; // r in the low byte, aligned to CUBEMAP_ALIGN inside storage or a view
+};
@@ -1,22 +1,32 @@
 #include "graphic.h"
+#include "rasterizer.h"
+#include "parallel.h"
+#include "sample.h"
+#include "ibl.h"
+#include "simd.h"
 #include "cassert"
+#include <memory>
 #include <queue>;
 
-Matrix ModelView;
-Matrix Viewport;
-Matrix Projection;
+Mat4 ModelView;
+Mat4 Viewport;
+Mat4 Projection;
+render_state_t RenderState;
 
 IShader::~IShader() {}
 
-static int is_back_facing(Vec3 ndc_pos[3])
+int IShader::fragment8(const float8* bar, int mask, TGAColor* color)
 {
-	Vec3 a = ndc_pos[0];
-	Vec3 b = ndc_pos[1];
-	Vec3 c = ndc_pos[2];
-	float signed_area = a.x * b.y - a.y * b.x +
-		b.x * c.y - b.y * c.x +
-		c.x * a.y - c.y * a.x;   //|AB AC|
-	return signed_area <= 0;
+	float w[3][8];
+	for (int k = 0; k < 3; k++)
+		bar[k].store(w[k]);
+
+	int written = 0;
+	for (int l = 0; l < 8; l++) {
+		if ((mask >> l & 1) && !fragment(Vec3(w[0][l], w[1][l], w[2][l]), color[l]))
+			written |= 1 << l;
+	}
+	return written;
 }
 
 void line(int x0, int y0, int x1, int y1, TGAImage& image, TGAColor color) {
@@ -55,71 +65,12 @@ void line(int x0, int y0, int x1, int y1, TGAImage& image, TGAColor color) {
 	}
 }
 
-void triangle(Vec4* verts, IShader &shader, float* zbuffer, TGAImage& image) {
-
-	int width = image.get_width();
-
-	Vec3 v1 = mtov3(shader.Viewport * vtom(verts[0]));
-	Vec3 v2 = mtov3(shader.Viewport * vtom(verts[1]));
-	Vec3 v3 = mtov3(shader.Viewport * vtom(verts[2]));
-
-	Vec3 v[3] = { v1, v2, v3 };
-	//backface clip
-	if (is_back_facing(v))
-		return;
-
-	/*Vec3 v1 = verts[0], v2 = verts[1], v3 = verts[2];*/
-	float z1 = v1.z, z2 = v2.z, z3 = v3.z;
-
-	//bounding box
-	int x_max = std::max(v1.x, std::max(v2.x, v3.x));
-	int x_min = std::min(v1.x, std::min(v2.x, v3.x));
-	int y_max = std::max(v1.y, std::max(v2.y, v3.y));
-	int y_min = std::min(v1.y, std::min(v2.y, v3.y));
-
-	Vec3 AC = to(v1, v3);
-	Vec3 CB = to(v3, v2);
-	Vec3 S = cross(AC, CB);
-	float SS = dot(S, S);
-
-	Vec2 uv;
-
-	for (int i = x_min; i <= x_max; i++) {
-		for (int j = y_min; j <= y_max; j++) {
-			Vec3 P(i, j, 0);
-			Vec3 PA = to(P, v1);
-			Vec3 PC = to(P, v3);
-			float S1 = dot(cross(PC, CB), S);
-			float S2 = dot(cross(PA, AC), S);
-			float alpha = S1 / SS, beta = S2 / SS, gamma = 1.f - alpha - beta;
-
-			Vec3 bar(alpha, beta, gamma);
-			if (alpha >= 0 && beta >= 0 && gamma >= 0) {
-				//perspective-correct interpolation
-				float z = 1 / (alpha / z1 + beta / z2 + gamma / z3);
-				 uv.x = z * (alpha * shader.payload.uv[0].x / z1 + beta * shader.payload.uv[1].x / z2 + gamma * shader.payload.uv[2].x / z3);
-				 uv.y = z * (alpha * shader.payload.uv[0].y / z1 + beta * shader.payload.uv[1].y / z2 + gamma * shader.payload.uv[2].y / z3);
-
-				TGAColor color;
-				shader.fragment(bar, uv, color);
-				int idx = i * width + j;
-
-				if (z > zbuffer[idx]) {
-					zbuffer[idx] = z;
-					image.set(i, j, TGAColor(color.r , color.g, color.b));
-				}
-			}
-		}
-	}
-
-}
-
 void lookat(Vec3 look_direction, Vec3 eye_pos, Vec3 up) {
 	Vec3 z = normalize(look_direction);
 	Vec3 x = normalize(cross(up, z));
 	Vec3 y = normalize(cross(z, x));
-	Matrix r = Matrix::eye(4);
-	Matrix t = Matrix::eye(4);
+	Mat4 r = Mat4::eye();
+	Mat4 t = Mat4::eye();
 	for (int i = 0; i < 3; i++) {
 		r[0][i] = x[i];
 		r[1][i] = y[i];
@@ -130,7 +81,7 @@ void lookat(Vec3 look_direction, Vec3 eye_pos, Vec3 up) {
 }
 
 void viewport(int w, int h) {
-	Matrix m = Matrix::eye(4);
+	Mat4 m = Mat4::eye();
 	m[0][3] = w / 2.f;
 	m[1][3] = h / 2.f;
 	m[0][0] = w / 2.f;
@@ -140,7 +91,7 @@ void viewport(int w, int h) {
 
 // origin orthographic matrix
 void projection_orth(float l, float r, float t, float b, float n, float f) {
-	Matrix m = Matrix(4, 4);
+	Mat4 m{};
 	m[0][0] = 2. / (r - l);
 	m[0][3] = (r + l) / (l - r);
 
@@ -164,7 +115,7 @@ void projection_orth(const View_frustum& frt) {
 	b = frt.b;
 	t = frt.t;
 
-	Matrix m = Matrix(4, 4);
+	Mat4 m{};
 	m[0][0] = 2. / (l - r);
 	m[0][3] = (r + l) / (r - l);
 
@@ -179,7 +130,7 @@ void projection_orth(const View_frustum& frt) {
 }
 
 void projection(float l, float r, float t, float b, float n, float f) {
-	Matrix m = Matrix(4, 4);
+	Mat4 m{};
 	m[0][0] = 2. * n / (r - l);
 	m[0][2] = (r + l) / (l - r);
 
@@ -202,7 +153,7 @@ void projection(const View_frustum& frt) {
 	b = frt.b;
 	t = frt.t;
 
-	Matrix m = Matrix(4, 4);
+	Mat4 m{};
 	m[0][0] = 2. * n / (r - l);
 	m[0][2] = (r + l) / (l - r);
 
@@ -230,57 +181,61 @@ bool cull(const Matrix& m) {
 	return false;
 }
 
-TGAImage* texture_from_file(const char* file_name)
+Texture* texture_from_file(const char* file_name)
 {
-	TGAImage* texture = new TGAImage();
-	texture->read_tga_file(file_name);
-	texture->flip_vertically();
-	return texture;
+	return Texture::from_file(file_name);
 }
 
-cubemap_t* cubemap_from_files(const char* positive_x, const char* negative_x,
-	const char* positive_y, const char* negative_y,
-	const char* positive_z, const char* negative_z)
+// <env_path>/<prefix>_<face>.tga for the six faces of a cubemap level
+static void face_paths(std::string* paths, const char* env_path, const char* prefix)
 {
-	cubemap_t* cubemap = new cubemap_t();
-	cubemap->faces[0] = texture_from_file(positive_x);
-	cubemap->faces[1] = texture_from_file(negative_x);
-	cubemap->faces[2] = texture_from_file(positive_y);
-	cubemap->faces[3] = texture_from_file(negative_y);
-	cubemap->faces[4] = texture_from_file(positive_z);
-	cubemap->faces[5] = texture_from_file(negative_z);
-	return cubemap;
+	const char* names[6] = { "px", "nx", "py", "ny", "pz", "nz" };
+	char path[256];
+	for (int j = 0; j < 6; j++) {
+		sprintf_s(path, "%s/%s_%s.tga", env_path, prefix, names[j]);
+		paths[j] = path;
+	}
 }
 
-void load_ibl_map(payload_t& p, const char* env_path)
+iblmap_t* load_ibl_map(const char* env_path)
 {
-	int i, j;
-	iblmap_t* iblmap = new iblmap_t();
-	const char* faces[6] = { "px", "nx", "py", "ny", "pz", "nz" };
-	char paths[6][256];
+	// a single environment cubemap is precomputed, or read back from its cache, instead of the baked set
+	iblmap_t* precomputed = precompute_ibl(env_path);
+	if (precomputed)
+		return precomputed;
 
+	int i;
+	iblmap_t* iblmap = new iblmap_t();
 	iblmap->mip_levels = 10;
 
-	/* diffuse environment map */
-	for (j = 0; j < 6; j++) {
-		sprintf_s(paths[j], "%s/i_%s.tga", env_path, faces[j]);
-	}
-	iblmap->irradiance_map = cubemap_from_files(paths[0], paths[1], paths[2],
-		paths[3], paths[4], paths[5]);
-
-	/* specular environment maps */
+	// irradiance faces, then the faces of every specular level, decoded on all cores
+	int count = (1 + iblmap->mip_levels) * 6;
+	std::vector<std::string> paths(count);
+	std::vector<Texture*> faces(count);
+	char prefix[16];
+	face_paths(&paths[0], env_path, "i");
 	for (i = 0; i < iblmap->mip_levels; i++) {
-		for (j = 0; j < 6; j++) {
-			sprintf_s(paths[j], "%s/m%d_%s.tga", env_path, i, faces[j]);
-		}
-		iblmap->prefilter_maps[i] = cubemap_from_files(paths[0], paths[1],
-			paths[2], paths[3], paths[4], paths[5]);
+		sprintf_s(prefix, "m%d", i);
+		face_paths(&paths[(i + 1) * 6], env_path, prefix);
 	}
+	parallel_for(0, count, 1, [&](int begin, int end) {
+		for (int f = begin; f < end; f++)
+			faces[f] = texture_from_file(paths[f].c_str());
+	});
+
+	/* diffuse environment map */
+	iblmap->irradiance_map = new Cubemap(&faces[0], 1);
+	sh9_project(iblmap->irradiance_map, iblmap->irradiance_sh);
+
+	/* specular environment maps, copied into one allocation */
+	iblmap->prefilter_map = new Cubemap(&faces[6], iblmap->mip_levels);
+	for (i = 0; i < count; i++)
+		delete faces[i];
 
 	/* brdf lookup texture */
 	iblmap->brdf_lut = texture_from_file("./obj/common/BRDF_LUT.tga");
 
-	p.iblmap = iblmap;
+	return iblmap;
 }
 
 //clipping
@@ -291,9 +246,18 @@ typedef enum {
 	Y_TOP,
 	Y_BOTTOM,
 	Z_NEAR,
-	Z_FAR
+	Z_FAR,
+	// X/Y planes pushed out to the guard band
+	X_RIGHT_GUARD,
+	X_LEFT_GUARD,
+	Y_TOP_GUARD,
+	Y_BOTTOM_GUARD
 } clip_plane;
 
+#define VIEW_PLANES 0x7f
+#define XY_PLANES (1 << X_RIGHT | 1 << X_LEFT | 1 << Y_TOP | 1 << Y_BOTTOM)
+#define GUARD_PLANES (1 << X_RIGHT_GUARD | 1 << X_LEFT_GUARD | 1 << Y_TOP_GUARD | 1 << Y_BOTTOM_GUARD)
+
 static int is_inside_plane(clip_plane c_plane, Vec4 vertex)
 {
 	switch (c_plane)
@@ -312,6 +276,14 @@ static int is_inside_plane(clip_plane c_plane, Vec4 vertex)
 		return vertex.z > vertex.w;
 	case Z_FAR:
 		return vertex.z < -vertex.w;
+	case X_RIGHT_GUARD:
+		return vertex.x > GUARD_BAND * vertex.w;
+	case X_LEFT_GUARD:
+		return vertex.x < -GUARD_BAND * vertex.w;
+	case Y_TOP_GUARD:
+		return vertex.y > GUARD_BAND * vertex.w;
+	case Y_BOTTOM_GUARD:
+		return vertex.y < -GUARD_BAND * vertex.w;
 	default:
 		return 0;
 	}
@@ -335,17 +307,24 @@ static float get_intersect_ratio(Vec4 prev, Vec4 curv, clip_plane c_plane)
 		return (prev.w - prev.z) / ((prev.w - prev.z) - (curv.w - curv.z));
 	case Z_FAR:
 		return (prev.w + prev.z) / ((prev.w + prev.z) - (curv.w + curv.z));
+	case X_RIGHT_GUARD:
+		return (GUARD_BAND * prev.w - prev.x) / ((GUARD_BAND * prev.w - prev.x) - (GUARD_BAND * curv.w - curv.x));
+	case X_LEFT_GUARD:
+		return (GUARD_BAND * prev.w + prev.x) / ((GUARD_BAND * prev.w + prev.x) - (GUARD_BAND * curv.w + curv.x));
+	case Y_TOP_GUARD:
+		return (GUARD_BAND * prev.w - prev.y) / ((GUARD_BAND * prev.w - prev.y) - (GUARD_BAND * curv.w - curv.y));
+	case Y_BOTTOM_GUARD:
+		return (GUARD_BAND * prev.w + prev.y) / ((GUARD_BAND * prev.w + prev.y) - (GUARD_BAND * curv.w + curv.y));
 	default:
 		return 0;
 	}
 }
 
-static int clip_with_plane(clip_plane c_plane, int num_vert, payload_t& payload)
+static int clip_with_plane(clip_plane c_plane, int num_vert, payload_t& payload, bool is_odd)
 {
 	int i;
 	int out_vert_num = 0;
 	int previous_index, current_index;
-	int is_odd = (c_plane + 1) % 2;
 
 	Vec4* in_clipcoord = is_odd ? payload.in_clip : payload.out_clip;
 	Vec3* in_worldcoord = is_odd ? payload.in_world : payload.out_world;
@@ -393,47 +372,186 @@ static int clip_with_plane(clip_plane c_plane, int num_vert, payload_t& payload)
 	return out_vert_num;
 }
 
-static int homo_clipping(payload_t& payload)
+// clip the triangle in the in_ arrays against the planes set in `planes`. Passes alternate between
+// the in_ and out_ arrays, `in_out` is set when the result ends up in the out_ arrays.
+// A plane no vertex is outside of can not cut the polygon, so callers pass the union of the outcodes.
+static int homo_clipping(payload_t& payload, int planes, bool& in_out)
 {
 	int num_vertex = 3;
-	num_vertex = clip_with_plane(W_PLANE, num_vertex, payload);
-	num_vertex = clip_with_plane(X_RIGHT, num_vertex, payload);
-	num_vertex = clip_with_plane(X_LEFT, num_vertex, payload);
-	num_vertex = clip_with_plane(Y_TOP, num_vertex, payload);
-	num_vertex = clip_with_plane(Y_BOTTOM, num_vertex, payload);
-	num_vertex = clip_with_plane(Z_NEAR, num_vertex, payload);
-	num_vertex = clip_with_plane(Z_FAR, num_vertex, payload);
+	in_out = false;
+	for (int p = W_PLANE; p <= Y_BOTTOM_GUARD; p++) {
+		if (!(planes >> p & 1))
+			continue;
+		num_vertex = clip_with_plane((clip_plane)p, num_vertex, payload, !in_out);
+		in_out = !in_out;
+	}
 	return num_vertex;
 }
 
-static void transform_attri(payload_t& payload, int index0, int index1, int index2)
+// clipped polygons end up in the out_ arrays, unclipped triangles are still in the in_ arrays
+static void transform_attri(payload_t& payload, bool clipped, int index0, int index1, int index2)
 {
-	payload.clip[0] = payload.out_clip[index0];
-	payload.clip[1] = payload.out_clip[index1];
-	payload.clip[2] = payload.out_clip[index2];
-	payload.world[0] = payload.out_world[index0];
-	payload.world[1] = payload.out_world[index1];
-	payload.world[2] = payload.out_world[index2];
-	payload.normal[0] = payload.out_normal[index0];
-	payload.normal[1] = payload.out_normal[index1];
-	payload.normal[2] = payload.out_normal[index2];
-	payload.uv[0] = payload.out_uv[index0];
-	payload.uv[1] = payload.out_uv[index1];
-	payload.uv[2] = payload.out_uv[index2];
+	const Vec4* clip = clipped ? payload.out_clip : payload.in_clip;
+	const Vec3* world = clipped ? payload.out_world : payload.in_world;
+	const Vec3* normal = clipped ? payload.out_normal : payload.in_normal;
+	const Vec2* uv = clipped ? payload.out_uv : payload.in_uv;
+	payload.clip[0] = clip[index0];
+	payload.clip[1] = clip[index1];
+	payload.clip[2] = clip[index2];
+	payload.world[0] = world[index0];
+	payload.world[1] = world[index1];
+	payload.world[2] = world[index2];
+	payload.normal[0] = normal[index0];
+	payload.normal[1] = normal[index1];
+	payload.normal[2] = normal[index2];
+	payload.uv[0] = uv[index0];
+	payload.uv[1] = uv[index1];
+	payload.uv[2] = uv[index2];
 }
 
+// transform verts[begin, end) to clip space, 8 (AVX2) or 4 (SSE) vertices per iteration
+static void transform_range(const Mat4& m, const Vec3* verts, int begin, int end, vertex_buffer_t& out)
+{
+	float* rows[4] = { out.x.data(), out.y.data(), out.z.data(), out.w.data() };
+	int i = begin;
+
+#if defined(USE_AVX2)
+	const __m256i stride = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+	for (; i + 8 <= end; i += 8) {
+		const float* p = &verts[i].x;
+		__m256 x = _mm256_i32gather_ps(p, stride, 4);
+		__m256 y = _mm256_i32gather_ps(p + 1, stride, 4);
+		__m256 z = _mm256_i32gather_ps(p + 2, stride, 4);
+		for (int r = 0; r < 4; r++) {
+			__m256 v = _mm256_fmadd_ps(_mm256_set1_ps(m[r][0]), x, _mm256_set1_ps(m[r][3]));
+			v = _mm256_fmadd_ps(_mm256_set1_ps(m[r][1]), y, v);
+			v = _mm256_fmadd_ps(_mm256_set1_ps(m[r][2]), z, v);
+			_mm256_storeu_ps(rows[r] + i, v);
+		}
+	}
+#endif
+
+#if defined(USE_SSE)
+	for (; i + 4 <= end; i += 4) {
+		// 4 packed Vec3 -> x, y, z lanes
+		const float* p = &verts[i].x;
+		__m128 a = _mm_loadu_ps(p);			// x0 y0 z0 x1
+		__m128 b = _mm_loadu_ps(p + 4);		// y1 z1 x2 y2
+		__m128 c = _mm_loadu_ps(p + 8);		// z2 x3 y3 z3
+		__m128 x = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+		__m128 y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)),
+			_mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)),
+			_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+		for (int r = 0; r < 4; r++) {
+			__m128 v = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[r][0]), x), _mm_mul_ps(_mm_set1_ps(m[r][1]), y));
+			v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(m[r][2]), z));
+			v = _mm_add_ps(v, _mm_set1_ps(m[r][3]));
+			_mm_storeu_ps(rows[r] + i, v);
+		}
+	}
+#endif
+
+	for (; i < end; i++) {
+		Vec4 v = m * verts[i];
+		rows[0][i] = v.x;
+		rows[1][i] = v.y;
+		rows[2][i] = v.z;
+		rows[3][i] = v.w;
+	}
+}
 
-void draw_triangles(TGAImage& image, float* zbuffer, IShader& shader, int nface)
+// the negation of is_inside_plane for every clip plane, branch free so outcode_range vectorizes
+static inline int outcode(float x, float y, float z, float w)
 {
-	int i;
+	float g = GUARD_BAND * w;
+	return !(w < -EPSILON) << W_PLANE
+		| !(x > w) << X_RIGHT
+		| !(x < -w) << X_LEFT
+		| !(y > w) << Y_TOP
+		| !(y < -w) << Y_BOTTOM
+		| !(z > w) << Z_NEAR
+		| !(z < -w) << Z_FAR
+		| !(x > g) << X_RIGHT_GUARD
+		| !(x < -g) << X_LEFT_GUARD
+		| !(y > g) << Y_TOP_GUARD
+		| !(y < -g) << Y_BOTTOM_GUARD;
+}
+
+// outcodes of vertices [begin, end)
+static void outcode_range(vertex_buffer_t& out, int begin, int end)
+{
+	const float* x = out.x.data();
+	const float* y = out.y.data();
+	const float* z = out.z.data();
+	const float* w = out.w.data();
+	uint16_t* code = out.outcode.data();
+	for (int i = begin; i < end; i++)
+		code[i] = (uint16_t)outcode(x[i], y[i], z[i], w[i]);
+}
+
+// transform every vertex of a mesh once, so vertices shared by several faces are not recomputed
+void transform_vertices(const Mat4& mvp, const Model& mesh, vertex_buffer_t& out)
+{
+	const Vec3* verts = mesh.vertices();
+	int n = mesh.n_verts();
+	out.x.resize(n);
+	out.y.resize(n);
+	out.z.resize(n);
+	out.w.resize(n);
+	out.outcode.resize(n);
+	out.indices = mesh.face_indices();
+
+	parallel_for(0, n, 16384, [&](int begin, int end) {
+		transform_range(mvp, verts, begin, end, out);
+		outcode_range(out, begin, end);
+	});
+}
+
+void assemble_face(IShader& shader, int nface, std::vector<raster_tri_t>& out)
+{
+	int i, k;
+	payload_t& payload = shader.payload;
+	const vertex_buffer_t* vbuf = payload.vbuf;
+	bool batched = vbuf && vbuf->indices;
+	int c0 = 0, c1 = 0, c2 = 0;
+	if (batched) {
+		const uint32_t* face = vbuf->indices + nface * 3;
+		c0 = vbuf->outcode[face[0]];
+		c1 = vbuf->outcode[face[1]];
+		c2 = vbuf->outcode[face[2]];
+		//trivial reject when all vertices are outside the same plane of the view frustum
+		if (c0 & c1 & c2 & VIEW_PLANES)
+			return;
+		//backface clip on the transformed positions, before any vertex shading
+		if (is_culled(clip_space_det(vbuf->x[face[0]], vbuf->y[face[0]], vbuf->w[face[0]],
+			vbuf->x[face[1]], vbuf->y[face[1]], vbuf->w[face[1]],
+			vbuf->x[face[2]], vbuf->y[face[2]], vbuf->w[face[2]])))
+			return;
+	}
+
 	//vertex shader
 	for (i = 0; i < 3; i++)
 	{
 		shader.vertex(nface, i);
 	}
 
-	//homogeneous clipping
-	int num_vertex = homo_clipping(shader.payload);
+	if (!batched) {
+		c0 = outcode(payload.in_clip[0].x, payload.in_clip[0].y, payload.in_clip[0].z, payload.in_clip[0].w);
+		c1 = outcode(payload.in_clip[1].x, payload.in_clip[1].y, payload.in_clip[1].z, payload.in_clip[1].w);
+		c2 = outcode(payload.in_clip[2].x, payload.in_clip[2].y, payload.in_clip[2].z, payload.in_clip[2].w);
+		if (c0 & c1 & c2 & VIEW_PLANES)
+			return;
+		if (is_culled(payload.in_clip))
+			return;
+	}
+
+	//homogeneous clipping, only against the planes the triangle crosses. In guard band mode
+	//the rasterizer scissor cuts X/Y, so they are only clipped where they leave the guard band.
+	int planes = c0 | c1 | c2;
+	planes &= RenderState.guard_band ? ~XY_PLANES : ~GUARD_PLANES;
+	bool clipped = false;
+	int num_vertex = planes ? homo_clipping(payload, planes, clipped) : 3;
 
 	//triangle assembly
 	for (i = 0; i < num_vertex - 2; i++) {
@@ -441,8 +559,62 @@ void draw_triangles(TGAImage& image, float* zbuffer, IShader& shader, int nface)
 		int index1 = i + 1;
 		int index2 = i + 2;
 		//transform data to real vertex attri
-		transform_attri(shader.payload, index0, index1, index2);
-
-		triangle(shader.payload.clip, shader, zbuffer, image);
+		transform_attri(shader.payload, clipped, index0, index1, index2);
+
+		raster_tri_t t;
+		for (k = 0; k < 3; k++) {
+			t.screen[k] = v4tov3(shader.Viewport * shader.payload.clip[k]);
+			t.clip[k] = shader.payload.clip[k];
+			t.world[k] = shader.payload.world[k];
+			t.normal[k] = shader.payload.normal[k];
+			t.uv[k] = shader.payload.uv[k];
+		}
+		out.push_back(t);
 	}
 }
+
+void assemble_mesh(IShader& shader, int nfaces, int tiles_x, int tiles_y, std::vector<geometry_chunk_t>& chunks)
+{
+	int ntiles = tiles_x * tiles_y;
+	int nchunk = std::max(1, std::min(worker_count() * 4, (nfaces + 1023) / 1024));
+	chunks.resize(nchunk);
+
+	parallel_for(0, nchunk, 1, [&](int begin, int end) {
+		std::unique_ptr<IShader> local(shader.clone());
+		for (int c = begin; c < end; c++) {
+			geometry_chunk_t& chunk = chunks[c];
+			int first = (int)((long long)nfaces * c / nchunk);
+			int last = (int)((long long)nfaces * (c + 1) / nchunk);
+			for (int f = first; f < last; f++)
+				assemble_face(*local, f, chunk.tris);
+
+			chunk.bins.resize(ntiles);
+			for (uint32_t t = 0; t < chunk.tris.size(); t++) {
+				int x_min, y_min, x_max, y_max;
+				pixel_bounds(chunk.tris[t].screen, x_min, y_min, x_max, y_max);
+				int tx0 = std::max(x_min, 0) / TILE_SIZE;
+				int ty0 = std::max(y_min, 0) / TILE_SIZE;
+				int tx1 = std::min(x_max / TILE_SIZE, tiles_x - 1);
+				int ty1 = std::min(y_max / TILE_SIZE, tiles_y - 1);
+				for (int ty = ty0; ty <= ty1; ty++)
+					for (int tx = tx0; tx <= tx1; tx++)
+						chunk.bins[ty * tiles_x + tx].push_back(t);
+			}
+		}
+	});
+}
+
+void triangle(Vec4* verts, IShader& shader, float* zbuffer, TGAImage& image)
+{
+	triangle<IShader>(verts, shader, zbuffer, image);
+}
+
+void draw_triangles(TGAImage& image, float* zbuffer, IShader& shader, int nface)
+{
+	draw_triangles<IShader>(image, zbuffer, shader, nface);
+}
+
+void draw_mesh(TGAImage& image, float* zbuffer, IShader& shader, int nfaces)
+{
+	draw_mesh<IShader>(image, zbuffer, shader, nfaces);
+}
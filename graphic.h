@@ -2,15 +2,42 @@
 #include "matrix.h"
 #include "tgaimage.h"
 #include "model.h"
+#include "texture.h"
+#include "cubemap.h"
+#include "simd.h"
 #include <vector>
 
 #define MAX_VERTEX 9
 #define EPSILON 1e-5f
 #define PI 3.1415926
+#define TILE_SIZE 64
+#define SUBPIXEL_BITS 8
+#define SUBPIXEL_ONE (1 << SUBPIXEL_BITS)
+// guard band half-extent in multiples of the viewport, keeps snapped vertices well inside fixed point range
+#define GUARD_BAND 8.f
 
-extern Matrix ModelView;
-extern Matrix Viewport;
-extern Matrix Projection;
+extern Mat4 ModelView;
+extern Mat4 Viewport;
+extern Mat4 Projection;
+
+typedef enum {
+	CULL_BACK,
+	CULL_FRONT,
+	CULL_NONE
+} cull_mode;
+
+// pipeline options shared by all draws
+struct render_state_t
+{
+	// faces are front facing when counter-clockwise on screen
+	cull_mode cull = CULL_BACK;
+	// lay down depth for the whole mesh first, then shade only the fragment that ends up visible in each pixel
+	bool depth_prepass = false;
+	// clip X/Y against the guard band instead of the viewport, the rasterizer scissor discards the rest
+	bool guard_band = true;
+};
+
+extern render_state_t RenderState;
 
 struct light
 {
@@ -23,17 +50,83 @@ struct View_frustum {
 	float l, b, r, t; // left, bottom, right, top
 };
 
-typedef struct cubemap {
-	TGAImage* faces[6];
-}cubemap_t;
+// post-transform vertex buffer, clip space positions in SoA layout.
+// outcode has bit (1 << plane) set for every clip plane the vertex lies outside of, indices is the
+// mesh index buffer (3 per face). A shader whose vertex() returns clip(i) may point payload.vbuf here,
+// draw_mesh then accepts or rejects whole faces from their outcodes without clipping.
+struct vertex_buffer_t
+{
+	std::vector<float> x, y, z, w;
+	std::vector<uint16_t> outcode;
+	const uint32_t* indices = nullptr;
+
+	int size() const { return (int)x.size(); }
+	Vec4 clip(int i) const { return Vec4(x[i], y[i], z[i], w[i]); }
+};
 
 typedef struct iblmap {
 	int mip_levels;
-	cubemap_t* irradiance_map;
-	cubemap_t* prefilter_maps[15];
-	TGAImage* brdf_lut;
+	Cubemap* irradiance_map;
+	Vec3 irradiance_sh[9]; // irradiance_map projected by sh9_project
+	Cubemap* prefilter_map; // level roughness * (mip_levels - 1)
+	Texture* brdf_lut;
 } iblmap_t;
 
+// perspective-correct attribute interpolation for one triangle. setup() runs once per triangle and
+// stores 1/w and every attribute divided by w as a plane over the barycentric weights,
+// a/w = a0 + bar.y * da1 + bar.z * da2, so a pixel costs a few multiply-adds and one reciprocal (Z).
+struct interpolator_t
+{
+	void setup(const Vec4* clip, const Vec3* world, const Vec3* normal, const Vec2* uv)
+	{
+		float iw[3];
+		for (int i = 0; i < 3; i++)
+			iw[i] = 1.f / clip[i].w;
+		w0 = iw[0];
+		dw1 = iw[1] - iw[0];
+		dw2 = iw[2] - iw[0];
+		plane(world, iw, world0, dworld1, dworld2);
+		plane(normal, iw, normal0, dnormal1, dnormal2);
+		Vec2 uvw[3] = { uv[0] * iw[0], uv[1] * iw[1], uv[2] * iw[2] };
+		uv0 = uvw[0];
+		duv1 = uvw[1] - uvw[0];
+		duv2 = uvw[2] - uvw[0];
+	}
+
+	// view depth w at the pixel, every other attribute is scaled by it
+	float Z(const Vec3& bar) const { return 1.f / (w0 + bar.y * dw1 + bar.z * dw2); }
+	Vec3 world(const Vec3& bar, float Z) const { return (world0 + dworld1 * bar.y + dworld2 * bar.z) * Z; }
+	Vec3 normal(const Vec3& bar, float Z) const { return (normal0 + dnormal1 * bar.y + dnormal2 * bar.z) * Z; }
+	Vec2 uv(const Vec3& bar, float Z) const { return (uv0 + duv1 * bar.y + duv2 * bar.z) * Z; }
+
+	// 8 lanes, bar points to the three weights
+	float8 Z(const float8* bar) const { return float8(1.f) / (float8(w0) + bar[1] * dw1 + bar[2] * dw2); }
+	Vec3x8 world(const float8* bar, const float8& Z) const { return lerp8(world0, dworld1, dworld2, bar, Z); }
+	Vec3x8 normal(const float8* bar, const float8& Z) const { return lerp8(normal0, dnormal1, dnormal2, bar, Z); }
+	Vec2x8 uv(const float8* bar, const float8& Z) const {
+		return Vec2x8((float8(uv0.x) + bar[1] * duv1.x + bar[2] * duv2.x) * Z,
+			(float8(uv0.y) + bar[1] * duv1.y + bar[2] * duv2.y) * Z);
+	}
+
+private:
+	static void plane(const Vec3* a, const float* iw, Vec3& a0, Vec3& da1, Vec3& da2)
+	{
+		a0 = a[0] * iw[0];
+		da1 = a[1] * iw[1] - a0;
+		da2 = a[2] * iw[2] - a0;
+	}
+
+	static Vec3x8 lerp8(const Vec3& a0, const Vec3& da1, const Vec3& da2, const float8* bar, const float8& Z)
+	{
+		return (Vec3x8(a0) + Vec3x8(da1) * bar[1] + Vec3x8(da2) * bar[2]) * Z;
+	}
+
+	float w0, dw1, dw2;
+	Vec3 world0, dworld1, dworld2;
+	Vec3 normal0, dnormal1, dnormal2;
+	Vec2 uv0, duv1, duv2;
+};
+
 struct payload_t
 {
 
@@ -54,22 +147,104 @@ struct payload_t
 	Vec4 out_clip[MAX_VERTEX];
 	// IBL
 	iblmap_t* iblmap;
+	// transformed vertices of the current mesh
+	const vertex_buffer_t* vbuf = nullptr;
+	// fragment depth, may be overwritten by shaders with late_depth_test
+	float frag_depth;
+	// attribute setup of the triangle being rasterized
+	interpolator_t interp;
 };
 
 
 struct IShader {
 	// transform matrix
-	Matrix MVP;
-	Matrix Viewport;
+	Mat4 MVP;
+	Mat4 Viewport;
 	
 	// other attribute
 	payload_t payload;
 
+	// fragment contract: fragment() returns true to discard the fragment, fragment8() leaves the
+	// lane out of its result. Shaders that write payload.frag_depth must set late_depth_test, their
+	// depth test then runs after shading. Shaders that can discard must set may_discard, the depth
+	// pre-pass would otherwise keep the depth of discarded fragments and hide what is behind them.
+	// Shaders with either flag are never drawn with the pre-pass; shaders without them only run on
+	// fragments which pass the depth test.
+	bool late_depth_test = false;
+	bool may_discard = false;
+
 	virtual ~IShader();
 	virtual Vec4 vertex(int iface, int nthvert) = 0;
-	virtual bool fragment(Vec3 bar, Vec2 _uv, TGAColor& color) = 0;
+	virtual bool fragment(Vec3 bar, TGAColor& color) = 0;
+	// shade a block of 2x4 pixels (two 2x2 quads), lane l is pixel (x + l / 4, y + l % 4).
+	// bar holds the screen-space barycentric weights of the three vertices, lanes outside the triangle
+	// are extrapolated. Only lanes set in `mask` need a color, returns the lanes that were not discarded.
+	// The default runs fragment() per lane.
+	virtual int fragment8(const float8* bar, int mask, TGAColor* color);
+	// copy for a worker thread, which shades into its own payload
+	virtual IShader* clone() const = 0;
 };
 
+// CRTP base of concrete shaders, declare them as `struct MyShader final : ShaderBase<MyShader>`.
+// Provides clone(), and a fragment8() which calls Derived::fragment() without virtual dispatch.
+template<typename Derived>
+struct ShaderBase : public IShader
+{
+	virtual IShader* clone() const { return new Derived(static_cast<const Derived&>(*this)); }
+
+	virtual int fragment8(const float8* bar, int mask, TGAColor* color)
+	{
+		float w[3][8];
+		for (int k = 0; k < 3; k++)
+			bar[k].store(w[k]);
+
+		Derived& self = static_cast<Derived&>(*this);
+		int written = 0;
+		for (int l = 0; l < 8; l++) {
+			if ((mask >> l & 1) && !self.fragment(Vec3(w[0][l], w[1][l], w[2][l]), color[l]))
+				written |= 1 << l;
+		}
+		return written;
+	}
+};
+
+// shader permutations: with_features<Mask>(features, fn) calls fn(feature_set<F>()) with F = features & Mask.
+// fn is instantiated once per subset of Mask, so a shader templated on F loses the branches of
+// every feature it was built without.
+template<int F>
+struct feature_set
+{
+	static const int value = F;
+};
+
+template<int Mask, int F = 0>
+struct feature_dispatch
+{
+	template<typename Fn>
+	static void run(int features, Fn& fn)
+	{
+		// next subset of Mask in increasing order, -1 after the last one
+		const int next = ((F - Mask) & Mask) == 0 ? -1 : ((F - Mask) & Mask);
+		if (features == F)
+			fn(feature_set<F>());
+		else
+			feature_dispatch<Mask, next>::run(features, fn);
+	}
+};
+
+template<int Mask>
+struct feature_dispatch<Mask, -1>
+{
+	template<typename Fn>
+	static void run(int, Fn&) {}
+};
+
+template<int Mask, typename Fn>
+void with_features(int features, Fn fn)
+{
+	feature_dispatch<Mask>::run(features & Mask, fn);
+}
+
 void line(int x0, int y0, int x1, int y1, TGAImage& image, TGAColor color);
 void triangle(Vec4* vec, IShader& shader, float* zbuffer, TGAImage& image);
 
@@ -81,6 +256,11 @@ void projection(float l, float r, float t, float b, float n, float f);
 void projection(const View_frustum& m);
 bool cull(const Matrix& m);
 
-void load_ibl_map(payload_t& p, const char* env_path);
+// the IBL maps of env_path, safe to run on a loader_pool() job
+iblmap_t* load_ibl_map(const char* env_path);
 
+void transform_vertices(const Mat4& mvp, const Model& mesh, vertex_buffer_t& out);
+// draw calls through IShader&, rasterizer.h has templates of triangle, draw_triangles and draw_mesh
+// over the concrete shader type
 void draw_triangles(TGAImage& image, float* zbuffer, IShader& shader, int nface);
+void draw_mesh(TGAImage& image, float* zbuffer, IShader& shader, int nfaces);
@@ -0,0 +1,381 @@
+#include "ibl.h"
+#include "sample.h"
+#include "parallel.h"
+#include "simd.h"
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+
+static const char* ibl_faces[6] = { "px", "nx", "py", "ny", "pz", "nz" };
+
+// everything the cache holds, texels in tga order (b, g, r) with rows from v = 0 up
+typedef struct
+{
+	Vec3 sh[9];
+	std::vector<uint8_t> prefilter[IBL_MIP_LEVELS][6];
+	std::vector<uint8_t> lut;
+} ibl_bake_t;
+
+typedef struct
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t hash;
+	int32_t prefilter_size, mip_levels, lut_size, samples;
+} ibl_cache_header_t;
+
+static int level_size(int level)
+{
+	return std::max(IBL_PREFILTER_SIZE >> level, 1);
+}
+
+// 64 bit FNV-1a
+static uint64_t fnv1a(uint64_t h, const char* data, size_t n)
+{
+	for (size_t i = 0; i < n; i++) {
+		h ^= (uint8_t)data[i];
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+static bool read_file(const std::string& path, std::string& out)
+{
+	std::ifstream in(path, std::ios::binary);
+	if (!in)
+		return false;
+	std::stringstream ss;
+	ss << in.rdbuf();
+	out = ss.str();
+	return true;
+}
+
+// linear radiance to the sqrt storage of the maps
+static uint8_t encode_sqrt(float v)
+{
+	v = sqrtf(std::max(v, 0.f));
+	return (uint8_t)(std::min(v, 1.f) * 255 + 0.5f);
+}
+
+static uint8_t encode_unorm(float v)
+{
+	return (uint8_t)(std::min(std::max(v, 0.f), 1.f) * 255 + 0.5f);
+}
+
+static void store_bgr(uint8_t* p, Vec3 c)
+{
+	p[0] = encode_sqrt(c.z);
+	p[1] = encode_sqrt(c.y);
+	p[2] = encode_sqrt(c.x);
+}
+
+// unit direction through the center of texel x, y of a face
+static Vec3 texel_direction(int face, int x, int y, int size)
+{
+	float sc = (x + 0.5f) / size * 2 - 1;
+	float tc = (y + 0.5f) / size * 2 - 1;
+	return normalize(cubemap_direction(face, sc, tc));
+}
+
+// linear radiance of the environment along a direction, from one of its levels
+static Vec3 env_radiance(const Cubemap* env, Vec3 dir, int level)
+{
+	Vec3 c = env->sample(dir, std::min(level, env->mip_levels() - 1));
+	return cwise_product(c, c);
+}
+
+static float radical_inverse(uint32_t bits)
+{
+	bits = (bits << 16u) | (bits >> 16u);
+	bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+	bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+	bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+	bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+	return (float)bits * 2.3283064365386963e-10f;
+}
+
+// GGX importance sampled half vectors around +z over the Hammersley set
+static void ggx_half_vectors(float roughness, float* hx, float* hy, float* hz)
+{
+	float a = roughness * roughness;
+	for (int i = 0; i < IBL_SAMPLES; i++) {
+		float phi = 2 * (float)PI * i / IBL_SAMPLES;
+		float xi = radical_inverse(i);
+		float cos_theta = sqrtf((1 - xi) / (1 + (a * a - 1) * xi));
+		float sin_theta = sqrtf(1 - cos_theta * cos_theta);
+		hx[i] = cosf(phi) * sin_theta;
+		hy[i] = sinf(phi) * sin_theta;
+		hz[i] = cos_theta;
+	}
+}
+
+static void prefilter_level(const Cubemap* env, int level, std::vector<uint8_t>* faces)
+{
+	int size = level_size(level);
+	for (int f = 0; f < 6; f++)
+		faces[f].resize((size_t)size * size * 3);
+
+	// roughness 0 is the environment itself
+	if (level == 0) {
+		parallel_for(0, 6 * size, 8, [&](int begin, int end) {
+			for (int r = begin; r < end; r++)
+				for (int x = 0; x < size; x++) {
+					Vec3 dir = texel_direction(r / size, x, r % size, size);
+					store_bgr(&faces[r / size][((size_t)(r % size) * size + x) * 3], env_radiance(env, dir, 0));
+				}
+		});
+		return;
+	}
+
+	// with n = v = r every sample term depends on the half vector only, so the light directions
+	// around +z, their n.l weights and the source level that covers their pdf footprint are set up
+	// once for the level. The list is padded to a multiple of 8 with zero weights.
+	float roughness = (float)level / (IBL_MIP_LEVELS - 1);
+	float a2 = roughness * roughness * roughness * roughness;
+	int env_size = env->face_size(0);
+	float texel_solid_angle = 4 * (float)PI / (6.f * env_size * env_size);
+	std::vector<float> hx(IBL_SAMPLES), hy(IBL_SAMPLES), hz(IBL_SAMPLES);
+	ggx_half_vectors(roughness, hx.data(), hy.data(), hz.data());
+
+	std::vector<float> lx, ly, lz, weight;
+	std::vector<int> src_level;
+	float weight_sum = 0;
+	for (int i = 0; i < IBL_SAMPLES; i++) {
+		float n_dot_h = hz[i];
+		float n_dot_l = 2 * n_dot_h * n_dot_h - 1;
+		if (n_dot_l <= 0)
+			continue;
+		float q = n_dot_h * n_dot_h * (a2 - 1) + 1;
+		float pdf = a2 / ((float)PI * q * q) / 4;
+		float sample_solid_angle = 1 / (IBL_SAMPLES * pdf + 1e-4f);
+		float lod = 0.5f * log2f(sample_solid_angle / texel_solid_angle) + 1;
+		lx.push_back(2 * n_dot_h * hx[i]);
+		ly.push_back(2 * n_dot_h * hy[i]);
+		lz.push_back(n_dot_l);
+		weight.push_back(n_dot_l);
+		src_level.push_back(lod > 0 ? (int)(lod + 0.5f) : 0);
+		weight_sum += n_dot_l;
+	}
+	while (lx.size() % 8) {
+		lx.push_back(0);
+		ly.push_back(0);
+		lz.push_back(1);
+		weight.push_back(0);
+		src_level.push_back(0);
+	}
+	int count = (int)lx.size();
+
+	parallel_for(0, 6 * size, 1, [&](int begin, int end) {
+		for (int r = begin; r < end; r++)
+			for (int x = 0; x < size; x++) {
+				Vec3 n = texel_direction(r / size, x, r % size, size);
+				Vec3 up = fabs(n.z) < 0.999f ? Vec3(0, 0, 1) : Vec3(1, 0, 0);
+				Vec3 t = normalize(cross(up, n));
+				Vec3 b = cross(n, t);
+				Vec3x8 t8(t), b8(b), n8(n);
+
+				// rotate 8 samples into the frame of the texel at a time, fetch per sample
+				Vec3 sum(0, 0, 0);
+				for (int i = 0; i < count; i += 8) {
+					Vec3x8 l = t8 * float8::load(&lx[i]) + b8 * float8::load(&ly[i]) + n8 * float8::load(&lz[i]);
+					float dx[8], dy[8], dz[8];
+					l.x.store(dx);
+					l.y.store(dy);
+					l.z.store(dz);
+					for (int k = 0; k < 8; k++)
+						if (weight[i + k] > 0)
+							sum = sum + env_radiance(env, Vec3(dx[k], dy[k], dz[k]), src_level[i + k]) * weight[i + k];
+				}
+				store_bgr(&faces[r / size][((size_t)(r % size) * size + x) * 3], sum / weight_sum);
+			}
+	});
+}
+
+// split-sum scale and bias of f0 over (n.v, roughness), r = scale, g = bias, stored linear
+static void integrate_brdf_lut(std::vector<uint8_t>& lut)
+{
+	lut.resize((size_t)IBL_LUT_SIZE * IBL_LUT_SIZE * 3);
+	parallel_for(0, IBL_LUT_SIZE, 4, [&](int begin, int end) {
+		std::vector<float> hx(IBL_SAMPLES), hy(IBL_SAMPLES), hz(IBL_SAMPLES);
+		for (int y = begin; y < end; y++) {
+			float roughness = (y + 0.5f) / IBL_LUT_SIZE;
+			ggx_half_vectors(roughness, hx.data(), hy.data(), hz.data());
+			float k = roughness * roughness / 2;
+			for (int x = 0; x < IBL_LUT_SIZE; x++) {
+				float n_dot_v = (x + 0.5f) / IBL_LUT_SIZE;
+				float8 vx(sqrtf(1 - n_dot_v * n_dot_v)), vz(n_dot_v);
+				float8 g_v(n_dot_v / (n_dot_v * (1 - k) + k));
+				float8 scale(0.f), bias(0.f);
+				for (int i = 0; i < IBL_SAMPLES; i += 8) {
+					float8 h_x = float8::load(&hx[i]), h_z = float8::load(&hz[i]);
+					float8 v_dot_h = max8(vx * h_x + vz * h_z, 0.f);
+					// n.l of l = 2 (v.h) h - v, a sample under the horizon gets g = 0
+					float8 n_dot_l = max8(v_dot_h * h_z * 2.f - vz, 0.f);
+					float8 g = n_dot_l / (n_dot_l * (1 - k) + k) * g_v;
+					float8 g_vis = g * v_dot_h / (h_z * vz);
+					float8 m = float8(1.f) - v_dot_h;
+					float8 fc = m * m * m * m * m;
+					scale = scale + (float8(1.f) - fc) * g_vis;
+					bias = bias + fc * g_vis;
+				}
+				float s[8], c[8];
+				scale.store(s);
+				bias.store(c);
+				float a = 0, b = 0;
+				for (int l = 0; l < 8; l++) {
+					a += s[l];
+					b += c[l];
+				}
+				uint8_t* p = &lut[((size_t)y * IBL_LUT_SIZE + x) * 3];
+				p[0] = 0;
+				p[1] = encode_unorm(b / IBL_SAMPLES);
+				p[2] = encode_unorm(a / IBL_SAMPLES);
+			}
+		}
+	});
+}
+
+static void bake_ibl(const Cubemap* env, ibl_bake_t& bake)
+{
+	// irradiance is the radiance convolved with the clamped cosine, which scales the SH bands by
+	// 1, 2/3 and 1/4 (over pi, which the lambert term cancels)
+	sh9_project(env, bake.sh);
+	for (int i = 1; i < 9; i++)
+		bake.sh[i] = bake.sh[i] * (i < 4 ? 2.f / 3 : 0.25f);
+
+	for (int level = 0; level < IBL_MIP_LEVELS; level++)
+		prefilter_level(env, level, bake.prefilter[level]);
+	integrate_brdf_lut(bake.lut);
+}
+
+static void fill_header(ibl_cache_header_t& h, uint64_t hash)
+{
+	memcpy(h.magic, "IBLC", 4);
+	h.version = IBL_CACHE_VERSION;
+	h.hash = hash;
+	h.prefilter_size = IBL_PREFILTER_SIZE;
+	h.mip_levels = IBL_MIP_LEVELS;
+	h.lut_size = IBL_LUT_SIZE;
+	h.samples = IBL_SAMPLES;
+}
+
+static bool read_cache(const std::string& path, uint64_t hash, ibl_bake_t& bake)
+{
+	std::ifstream in(path, std::ios::binary);
+	if (!in)
+		return false;
+	ibl_cache_header_t expect, h;
+	fill_header(expect, hash);
+	if (!in.read((char*)&h, sizeof(h)) || memcmp(&h, &expect, sizeof(h)) != 0)
+		return false;
+
+	in.read((char*)bake.sh, sizeof(bake.sh));
+	for (int level = 0; level < IBL_MIP_LEVELS; level++) {
+		int size = level_size(level);
+		for (int f = 0; f < 6; f++) {
+			bake.prefilter[level][f].resize((size_t)size * size * 3);
+			in.read((char*)bake.prefilter[level][f].data(), bake.prefilter[level][f].size());
+		}
+	}
+	bake.lut.resize((size_t)IBL_LUT_SIZE * IBL_LUT_SIZE * 3);
+	in.read((char*)bake.lut.data(), bake.lut.size());
+	return (bool)in;
+}
+
+static void write_cache(const std::string& path, uint64_t hash, const ibl_bake_t& bake)
+{
+	std::ofstream out(path, std::ios::binary);
+	if (!out) {
+		std::cerr << "can't write ibl cache " << path << "\n";
+		return;
+	}
+	ibl_cache_header_t h;
+	fill_header(h, hash);
+	out.write((const char*)&h, sizeof(h));
+	out.write((const char*)bake.sh, sizeof(bake.sh));
+	for (int level = 0; level < IBL_MIP_LEVELS; level++)
+		for (int f = 0; f < 6; f++)
+			out.write((const char*)bake.prefilter[level][f].data(), bake.prefilter[level][f].size());
+	out.write((const char*)bake.lut.data(), bake.lut.size());
+}
+
+static Texture* texture_from_bgr(const uint8_t* texels, int size)
+{
+	TGAImage image(size, size, TGAImage::RGB);
+	memcpy(image.buffer(), texels, (size_t)size * size * 3);
+	return new Texture(image);
+}
+
+static iblmap_t* make_iblmap(const ibl_bake_t& bake)
+{
+	iblmap_t* iblmap = new iblmap_t();
+	iblmap->mip_levels = IBL_MIP_LEVELS;
+	for (int i = 0; i < 9; i++)
+		iblmap->irradiance_sh[i] = bake.sh[i];
+
+	// small irradiance cubemap for code that still samples one, evaluated from the SH
+	std::vector<uint8_t> texels((size_t)IBL_IRRADIANCE_SIZE * IBL_IRRADIANCE_SIZE * 3);
+	Texture* faces[IBL_MIP_LEVELS * 6];
+	for (int f = 0; f < 6; f++) {
+		for (int y = 0; y < IBL_IRRADIANCE_SIZE; y++)
+			for (int x = 0; x < IBL_IRRADIANCE_SIZE; x++) {
+				Vec3 n = texel_direction(f, x, y, IBL_IRRADIANCE_SIZE);
+				store_bgr(&texels[((size_t)y * IBL_IRRADIANCE_SIZE + x) * 3], sh9_irradiance(bake.sh, n));
+			}
+		faces[f] = texture_from_bgr(texels.data(), IBL_IRRADIANCE_SIZE);
+	}
+	iblmap->irradiance_map = new Cubemap(faces, 1);
+	for (int f = 0; f < 6; f++)
+		delete faces[f];
+
+	for (int level = 0; level < IBL_MIP_LEVELS; level++)
+		for (int f = 0; f < 6; f++)
+			faces[level * 6 + f] = texture_from_bgr(bake.prefilter[level][f].data(), level_size(level));
+	iblmap->prefilter_map = new Cubemap(faces, IBL_MIP_LEVELS);
+	for (int i = 0; i < IBL_MIP_LEVELS * 6; i++)
+		delete faces[i];
+	iblmap->brdf_lut = texture_from_bgr(bake.lut.data(), IBL_LUT_SIZE);
+	return iblmap;
+}
+
+iblmap_t* precompute_ibl(const char* env_path)
+{
+	std::string base(env_path);
+	std::string paths[6];
+	uint64_t hash = 14695981039346656037ull;
+	for (int f = 0; f < 6; f++) {
+		paths[f] = base + "/env_" + ibl_faces[f] + ".tga";
+		std::string data;
+		if (!read_file(paths[f], data))
+			return nullptr;
+		hash = fnv1a(hash, data.data(), data.size());
+	}
+	char name[32];
+	snprintf(name, sizeof(name), "/ibl_%016llx.cache", (unsigned long long)hash);
+	std::string cache_path = base + name;
+
+	ibl_bake_t bake;
+	if (read_cache(cache_path, hash, bake)) {
+		std::cout << "ibl cache " << cache_path << " loaded\n";
+		return make_iblmap(bake);
+	}
+
+	auto t0 = std::chrono::steady_clock::now();
+	Texture* faces[6];
+	for (int f = 0; f < 6; f++)
+		faces[f] = Texture::from_file(paths[f].c_str(), true);
+	Cubemap* env = Cubemap::from_face_mips(faces);
+	for (int f = 0; f < 6; f++)
+		delete faces[f];
+	bake_ibl(env, bake);
+	delete env;
+	write_cache(cache_path, hash, bake);
+
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	std::cout << "ibl precompute " << env_path << " in " << secs * 1000 << " ms, cached as " << cache_path << "\n";
+	return make_iblmap(bake);
+}
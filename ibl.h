@@ -0,0 +1,19 @@
+#pragma once
+#include "graphic.h"
+
+// face size of prefilter level 0, each level halves it down to 1
+#define IBL_PREFILTER_SIZE 128
+#define IBL_MIP_LEVELS 10
+#define IBL_IRRADIANCE_SIZE 32
+#define IBL_LUT_SIZE 128
+// GGX samples per prefiltered texel and per lut texel, a multiple of 8
+#define IBL_SAMPLES 512
+// bump when the precompute changes, old cache files then stop matching
+#define IBL_CACHE_VERSION 1
+
+// build the IBL maps of one environment cubemap, env_path/env_{px,nx,py,ny,pz,nz}.tga stored like
+// the baked maps as sqrt of the radiance: SH9 irradiance (and a small irradiance cubemap
+// evaluated from it), GGX prefiltered levels and the split-sum BRDF lut, with the work spread over
+// all cores. The result is cached in env_path/ibl_<hash>.cache, the hash taken over the source
+// files, and read back on later runs. Returns nullptr when the environment files are not there.
+iblmap_t* precompute_ibl(const char* env_path);
@@ -1,8 +1,15 @@
 #include "tgaimage.h"
 #include "graphic.h"
+#include "rasterizer.h"
 #include "model.h"
 #include "matrix.h"
 #include "sample.h"
+#include "benchmark.h"
+#include "bundle.h"
+#include "parallel.h"
+#include <cstring>
+#include <chrono>
+#include <future>
 
 Model* model = nullptr;
 float* shadowbuffer = nullptr;
@@ -92,7 +99,64 @@ static Vec3 Reinhard_mapping(Vec3& color)
 	return color;
 }
 
-static Vec3 cal_normal(Vec3& normal, Vec3* world_coords, const Vec2* uvs, const Vec2& uv, TGAImage* normal_map)
+// 8-lane tone mapping, gamma is applied per lane
+static Vec3x8 Reinhard_mapping8(const Vec3x8& color)
+{
+	float8 a = 2.51f, b = 0.03f, c = 2.43f, d = 0.59f, e = 0.14f;
+	const float8* in[3] = { &color.x, &color.y, &color.z };
+	float8 out[3];
+	for (int i = 0; i < 3; i++)
+	{
+		float8 value = *in[i];
+		value = (value * (a * value + b)) / (value * (c * value + d) + e);
+		value = min8(max8(value, 0.f), 1.f);
+
+		float lanes[8];
+		value.store(lanes);
+		for (int l = 0; l < 8; l++)
+			lanes[l] = pow(lanes[l], 1.0 / 2.2);
+		out[i] = float8::load(lanes);
+	}
+	return Vec3x8(out[0], out[1], out[2]);
+}
+
+// log2 of the uv footprint of each lane. Lane l is pixel (x + l / 4, y + l % 4), so lanes
+// 2q, 2q + 1, 4 + 2q and 5 + 2q form 2x2 quad q and share the lod of its uv differences.
+// Lanes outside the triangle still carry extrapolated uvs, which keeps the differences valid.
+static void quad_uv_lod8(const Vec2x8& uv, float* lod)
+{
+	float u[8], v[8];
+	uv.x.store(u);
+	uv.y.store(v);
+	for (int q = 0; q < 2; q++)
+	{
+		int l = 2 * q;
+		float dudx = u[l + 4] - u[l], dvdx = v[l + 4] - v[l];
+		float dudy = u[l + 1] - u[l], dvdy = v[l + 1] - v[l];
+		float rho2 = (std::max)(dudx * dudx + dvdx * dvdx, dudy * dudy + dvdy * dvdy);
+		lod[l] = lod[l + 1] = lod[l + 4] = lod[l + 5] = 0.5f * log2f(rho2);
+	}
+}
+
+// fetch one texel per live lane
+static Vec3x8 texture_sample8(const Vec2x8& uv, const float* lod, const Texture* image, int mask)
+{
+	float u[8], v[8], r[8] = {}, g[8] = {}, b[8] = {};
+	uv.x.store(u);
+	uv.y.store(v);
+	for (int l = 0; l < 8; l++)
+	{
+		if (!(mask >> l & 1))
+			continue;
+		Vec3 c = image->sample_lod(Vec2(u[l], v[l]), lod[l]);
+		r[l] = c.x;
+		g[l] = c.y;
+		b[l] = c.z;
+	}
+	return Vec3x8(float8::load(r), float8::load(g), float8::load(b));
+}
+
+static Vec3 cal_normal(Vec3& normal, Vec3* world_coords, const Vec2* uvs, const Vec2& uv, const Texture* normal_map)
 {
 	//calculate the difference in UV coordinate
 	float x1 = uvs[1][0] - uvs[0][0];
@@ -123,40 +187,90 @@ static Vec3 cal_normal(Vec3& normal, Vec3* world_coords, const Vec2* uvs, const
 	return normal_new;
 }
 
-struct Shader : public IShader {
-	Matrix MVP_Shadow;
+// tangent space normal mapping for 8 lanes, the tangent frame of the triangle is computed once
+static Vec3x8 cal_normal8(const Vec3x8& normal, Vec3* world_coords, const Vec2* uvs, const Vec2x8& uv,
+	const float* lod, const Texture* normal_map, int mask)
+{
+	//calculate the difference in UV coordinate
+	float x1 = uvs[1][0] - uvs[0][0];
+	float y1 = uvs[1][1] - uvs[0][1];
+	float x2 = uvs[2][0] - uvs[0][0];
+	float y2 = uvs[2][1] - uvs[0][1];
+	float det = (x1 * y2 - x2 * y1);
+
+	//calculate the difference in world pos
+	Vec3 e1 = world_coords[1] - world_coords[0];
+	Vec3 e2 = world_coords[2] - world_coords[0];
+
+	Vec3x8 t(e1 * y2 + e2 * (-y1));
+	Vec3x8 b(e1 * (-x2) + e2 * x1);
+	t = t * float8(1 / det);
+	b = b * float8(1 / det);
+
+	//Schmidt orthogonalization
+	Vec3x8 n = normalize8(normal);
+	t = normalize8(t - n * dot8(t, n));
+	b = normalize8(b - n * dot8(b, n) - t * dot8(b, t));
+
+	Vec3x8 sample = texture_sample8(uv, lod, normal_map, mask);
+	//modify the range 0 ~ 1 to -1 ~ +1
+	sample = Vec3x8(sample.x * 2.f - 1.f, sample.y * 2.f - 1.f, sample.z * 2.f - 1.f);
+
+	return t * sample.x + b * sample.y + n * sample.z;
+}
+
+// shader permutation bits, each one enables a texture or pass the shader would otherwise skip
+typedef enum {
+	FEATURE_NORMAL_MAP = 1,
+	FEATURE_OCCLUSION = 2,
+	FEATURE_EMISSION = 4,
+	FEATURE_SHADOW = 8
+} shader_feature;
+
+#define PBR_FEATURES (FEATURE_NORMAL_MAP | FEATURE_OCCLUSION | FEATURE_EMISSION)
+#define BLINPHONG_FEATURES (FEATURE_NORMAL_MAP | FEATURE_SHADOW)
+
+// features the model's texture set supports, picked once per draw
+static int material_features(const Model& m)
+{
+	int features = 0;
+	if (m.normalmap_)
+		features |= FEATURE_NORMAL_MAP;
+	if (m.has_occlusion)
+		features |= FEATURE_OCCLUSION;
+	if (m.emision_map)
+		features |= FEATURE_EMISSION;
+	if (shadowbuffer)
+		features |= FEATURE_SHADOW;
+	return features;
+}
+
+template<int Features>
+struct Shader final : public ShaderBase<Shader<Features>> {
+	using IShader::payload;
+	Mat4 MVP_Shadow;
 
 	virtual Vec4 vertex(int iface, int nthvert)
 	{
 		payload.in_world[nthvert] = model->getVert(iface, nthvert);
 		payload.in_normal[nthvert] = model->getVert(iface, nthvert);
-		payload.in_clip[nthvert] = mtov4(MVP * vtom(payload.in_world[nthvert]));
+		payload.in_clip[nthvert] = payload.vbuf->clip(model->vert_index(iface, nthvert));
 		payload.in_uv[nthvert] = model->getUV(iface, nthvert);
 		return payload.in_clip[nthvert];
 	}
 
-	bool direct_fragment(Vec3 bar, Vec2 _uv, TGAColor& color)
+	bool direct_fragment(Vec3 bar, TGAColor& color)
 	{
 		Vec3 CookTorrance_brdf;
 		Vec3 light_pos = Vec3(2, 1.5, 5);
 		Vec3 radiance = Vec3(3, 3, 3);
 
-		//for reading easily
-		Vec4* clip = payload.clip;
-		Vec3* world = payload.world;
-		Vec3* normals = payload.normal;
-		Vec2* uvs = payload.uv;
-
-		float alpha = bar.x, beta = bar.y, gamma = bar.z;
-
 		//interpolate attribute
-		float Z = 1.0 / (alpha / clip[0].w + beta / clip[1].w + gamma / clip[2].w);
-		Vec3 normal = (alpha * normals[0] / clip[0].w + beta * normals[1] / clip[1].w +
-			gamma * normals[2] / clip[2].w) * Z;
-		Vec2 uv = (alpha * uvs[0] / clip[0].w + beta * uvs[1] / clip[1].w +
-			gamma * uvs[2] / clip[2].w) * Z;
-		Vec3 worldpos = (alpha * world[0] / clip[0].w + beta * world[1] / clip[1].w +
-			gamma * world[2] / clip[2].w) * Z;
+		const interpolator_t& interp = payload.interp;
+		float Z = interp.Z(bar);
+		Vec3 normal = interp.normal(bar, Z);
+		Vec2 uv = interp.uv(bar, Z);
+		Vec3 worldpos = interp.world(bar, Z);
 
 		Vec3 l = normalize(light_dir * -1);
 		Vec3 n = normalize(normal);
@@ -172,8 +286,9 @@ struct Shader : public IShader {
 			float n_dot_h = float_max(dot(n, h), 0);
 			float h_dot_v = float_max(dot(h, v), 0);
 
-			float roughness = model->roughness(uv);
-			float metalness = model->metalness(uv);
+			Vec3 orm = model->material(uv);
+			float roughness = orm.y;
+			float metalness = orm.z;
 
 			//roughness = 0.2;
 			//metalness = 0.8;
@@ -201,29 +316,23 @@ struct Shader : public IShader {
 		return false;
 	}
 
-	virtual bool fragment(Vec3 bar, Vec2 _uv, TGAColor& color) {
+	virtual bool fragment(Vec3 bar, TGAColor& color) {
 		Vec3 CookTorrance_brdf;
 		Vec3 radiance = Vec3(3, 3, 3);
 
 		//for reading easily
-		Vec4* clip = payload.clip;
 		Vec3* world = payload.world;
-		Vec3* normals = payload.normal;
 		Vec2* uvs = payload.uv;
 
-		float alpha = bar.x, beta = bar.y, gamma = bar.z;
-
 		//interpolate attribute
-		float Z = 1.0 / (alpha / clip[0].w + beta / clip[1].w + gamma / clip[2].w);
-		Vec3 normal = (alpha * normals[0] / clip[0].w + beta * normals[1] / clip[1].w +
-			gamma * normals[2] / clip[2].w) * Z;
-		Vec2 uv = (alpha * uvs[0] / clip[0].w + beta * uvs[1] / clip[1].w +
-			gamma * uvs[2] / clip[2].w) * Z;
-		Vec3 worldpos = (alpha * world[0] / clip[0].w + beta * world[1] / clip[1].w +
-			gamma * world[2] / clip[2].w) * Z;
+		const interpolator_t& interp = payload.interp;
+		float Z = interp.Z(bar);
+		Vec3 normal = interp.normal(bar, Z);
+		Vec2 uv = interp.uv(bar, Z);
+		Vec3 worldpos = interp.world(bar, Z);
 
 
-		if (model->normalmap_)
+		if (Features & FEATURE_NORMAL_MAP)
 		{
 			normal = cal_normal(normal, world, uvs, uv, model->normalmap_);
 		}
@@ -235,10 +344,11 @@ struct Shader : public IShader {
 		Vec3 c(0.0f, 0.0f, 0.0f);
 		if (n_dot_v > 0)
 		{
-			float roughness = model->roughness(uv);
-			float metalness = model->metalness(uv);
-			float occlusion = model->occlusion(uv);
-			Vec3 emission = model->emission(uv);
+			Vec3 orm = model->material(uv);
+			float roughness = orm.y;
+			float metalness = orm.z;
+			float occlusion = (Features & FEATURE_OCCLUSION) ? orm.x : 1.0f;
+			Vec3 emission = (Features & FEATURE_EMISSION) ? model->emission(uv) : Vec3(0.0f, 0.0f, 0.0f);
 
 			//get albedo
 			Vec3 albedo = model->diffuse(uv);
@@ -250,10 +360,7 @@ struct Shader : public IShader {
 			Vec3 kD = (Vec3(1.0, 1.0, 1.0) - F) * (1 - metalness);
 
 			//diffuse color
-			cubemap_t* irradiance_map = payload.iblmap->irradiance_map;
-			Vec3 irradiance = cubemap_sampling(n, irradiance_map);
-			for (int i = 0; i < 3; i++)
-				irradiance[i] = pow(irradiance[i], 2.0f);
+			Vec3 irradiance = sh9_irradiance(payload.iblmap->irradiance_sh, n);
 			Vec3 diffuse = irradiance * kD * albedo;
 
 			//specular color
@@ -265,12 +372,12 @@ struct Shader : public IShader {
 			Vec3 specular = f0 * specular_scale + Vec3(specular_bias, specular_bias, specular_bias);
 			float max_mip_level = (float)(payload.iblmap->mip_levels - 1);
 			int specular_miplevel = (int)(roughness * max_mip_level + 0.5f);
-			Vec3 prefilter_color = cubemap_sampling(r, payload.iblmap->prefilter_maps[specular_miplevel]);
+			Vec3 prefilter_color = payload.iblmap->prefilter_map->sample(r, specular_miplevel);
 			for (int i = 0; i < 3; i++)
 				prefilter_color[i] = pow(prefilter_color[i], 2.0f);
 			specular = cwise_product(prefilter_color, specular);
 
-			c = (diffuse + specular) + emission;
+			c = (diffuse + specular) * occlusion + emission;
 		}
 
 		Reinhard_mapping(c);
@@ -279,43 +386,134 @@ struct Shader : public IShader {
 
 		return false;
 	}
+
+	// fragment() for a block of 8 pixels: interpolation, normal mapping and the IBL math run in
+	// SIMD lanes, texture fetches are gathered per live lane and the cubemap is looked up in one batch
+	virtual int fragment8(const float8* bar, int mask, TGAColor* color)
+	{
+		//for reading easily
+		Vec3* world = payload.world;
+		Vec2* uvs = payload.uv;
+
+		//interpolate attribute
+		const interpolator_t& interp = payload.interp;
+		float8 Z = interp.Z(bar);
+		Vec3x8 normal = interp.normal(bar, Z);
+		Vec2x8 uv = interp.uv(bar, Z);
+		Vec3x8 worldpos = interp.world(bar, Z);
+		float lod_l[8];
+		quad_uv_lod8(uv, lod_l);
+
+		if (Features & FEATURE_NORMAL_MAP)
+		{
+			normal = cal_normal8(normal, world, uvs, uv, lod_l, model->normalmap_, mask);
+		}
+
+		Vec3x8 n = normalize8(normal);
+		Vec3x8 v = normalize8(Vec3x8(eye_pos) - worldpos);
+		float8 n_dot_v = max8(dot8(n, v), 0.1f);
+
+		// material and environment fetches
+		float u_l[8], v_l[8], rough_l[8], metal_l[8], occlusion_l[8], nv_l[8];
+		int specular_l[8];
+		Vec3 albedo_l[8], emission_l[8], lut_l[8];
+		uv.x.store(u_l);
+		uv.y.store(v_l);
+		n_dot_v.store(nv_l);
+
+		float max_mip_level = (float)(payload.iblmap->mip_levels - 1);
+		for (int l = 0; l < 8; l++)
+		{
+			if (!(mask >> l & 1))
+			{
+				rough_l[l] = metal_l[l] = occlusion_l[l] = 0;
+				specular_l[l] = 0;
+				albedo_l[l] = emission_l[l] = lut_l[l] = Vec3(0, 0, 0);
+				continue;
+			}
+			Vec2 uv_l(u_l[l], v_l[l]);
+
+			Vec3 orm = model->material(uv_l, lod_l[l]);
+			rough_l[l] = orm.y;
+			metal_l[l] = orm.z;
+			occlusion_l[l] = (Features & FEATURE_OCCLUSION) ? orm.x : 1.0f;
+			emission_l[l] = (Features & FEATURE_EMISSION) ? model->emission(uv_l, lod_l[l]) : Vec3(0, 0, 0);
+			albedo_l[l] = model->diffuse(uv_l, lod_l[l]);
+
+			lut_l[l] = texture_sample(Vec2(nv_l[l], rough_l[l]), payload.iblmap->brdf_lut);
+			specular_l[l] = (int)(rough_l[l] * max_mip_level + 0.5f);
+		}
+
+		// one batched lookup of the reflection vectors in the prefiltered cubemap
+		Vec3x8 r = normalize8(n * (dot8(v, n) * 2.f) - v);
+		Vec3x8 prefilter_color = payload.iblmap->prefilter_map->sample8(r, specular_l);
+
+		float8 roughness = float8::load(rough_l);
+		float8 metalness = float8::load(metal_l);
+		Vec3x8 albedo = gather8(albedo_l), emission = gather8(emission_l);
+		Vec3x8 lut_sample = gather8(lut_l);
+		Vec3x8 irradiance = sh9_irradiance8(payload.iblmap->irradiance_sh, n);
+
+		Vec3x8 f0 = Vec3x8(Vec3(0.04f, 0.04f, 0.04f)) + (albedo - Vec3x8(Vec3(0.04f, 0.04f, 0.04f))) * metalness;
+
+		//fresenlschlick_roughness
+		float8 r1 = max8(float8(1.0f) - roughness, f0.x);
+		float8 m = float8(1.0f) - n_dot_v;
+		float8 m5 = m * m * m * m * m;
+		Vec3x8 F = f0 + (Vec3x8(r1, r1, r1) - f0) * m5;
+		Vec3x8 kD = (Vec3x8(Vec3(1.0f, 1.0f, 1.0f)) - F) * (float8(1.0f) - metalness);
+
+		//diffuse color
+		Vec3x8 diffuse = irradiance * kD * albedo;
+
+		//specular color
+		Vec3x8 specular = f0 * lut_sample.x + Vec3x8(lut_sample.y, lut_sample.y, lut_sample.y);
+		specular = prefilter_color * prefilter_color * specular;
+
+		Vec3x8 c = Reinhard_mapping8((diffuse + specular) * float8::load(occlusion_l) + emission) * float8(255.f);
+
+		float cr[8], cg[8], cb[8];
+		c.x.store(cr);
+		c.y.store(cg);
+		c.z.store(cb);
+		for (int l = 0; l < 8; l++)
+			color[l] = TGAColor(cr[l], cg[l], cb[l]);
+		return mask;
+	}
 };
 
-struct BlinPhongShader : public IShader {
-	Matrix MVP_Shadow;
+template<int Features>
+struct BlinPhongShader final : public ShaderBase<BlinPhongShader<Features>> {
+	using IShader::payload;
+	Mat4 MVP_Shadow;
 
 	virtual Vec4 vertex(int iface, int nthvert)
 	{
 		payload.in_world[nthvert] = model->getVert(iface, nthvert);
 		payload.in_normal[nthvert] = model->getVert(iface, nthvert);
-		payload.in_clip[nthvert] = mtov4(MVP * vtom(payload.in_world[nthvert]));
+		payload.in_clip[nthvert] = payload.vbuf->clip(model->vert_index(iface, nthvert));
 		payload.in_uv[nthvert] = model->getUV(iface, nthvert);
 		return payload.in_clip[nthvert];
 	}
 
-	virtual bool fragment(Vec3 bar, Vec2 _uv, TGAColor& color)
+	virtual bool fragment(Vec3 bar, TGAColor& color)
 	{
 		//set light information
 		float p = 5;
 		Vec3 amb_light_intensity(0.5, 0.5, 0.5);
 		light light1{ light_pos, light_intensity };
 		//payload information
-		Vec4* clip_coords = payload.clip;
 		Vec3* world_coords = payload.world;
-		Vec3* normals = payload.normal;
 		Vec2* uvs = payload.uv;
 
-		float alpha = bar.x, beta = bar.y, gamma = bar.z;
 		//interpolate attribute
-		float Z = 1.0 / (alpha / clip_coords[0].w + beta / clip_coords[1].w + gamma / clip_coords[2].w);
-		Vec3 normal = (alpha * normals[0] / clip_coords[0].w + beta * normals[1] / clip_coords[1].w +
-			gamma * normals[2] / clip_coords[2].w) * Z;
-		Vec2 uv = (alpha * uvs[0] / clip_coords[0].w + beta * uvs[1] / clip_coords[1].w +
-			gamma * uvs[2] / clip_coords[2].w) * Z;
-		Vec3 worldpos = (alpha * world_coords[0] / clip_coords[0].w + beta * world_coords[1] / clip_coords[1].w +
-			gamma * world_coords[2] / clip_coords[2].w) * Z;
-
-		if (model->normalmap_)
+		const interpolator_t& interp = payload.interp;
+		float Z = interp.Z(bar);
+		Vec3 normal = interp.normal(bar, Z);
+		Vec2 uv = interp.uv(bar, Z);
+		Vec3 worldpos = interp.world(bar, Z);
+
+		if (Features & FEATURE_NORMAL_MAP)
 		{
 			normal = cal_normal(normal, world_coords, uvs, uv, model->normalmap_);
 		}
@@ -338,9 +536,18 @@ struct BlinPhongShader : public IShader {
 		diffuse = cwise_product(kd, light1.intensity) * float_max(0, dot(l, normal));
 		specular = cwise_product(ks, light1.intensity) * float_max(0, pow(dot(normal, h), p));
 
-		Vec3 light_space_pos = mtov3(MVP_Shadow * vtom(bary_inter(payload.world, bar)));
-		float light_space_depth = shadowbuffer[int(light_space_pos.x) * width + int(light_space_pos.y)];
-		float shadow = .3 + .7 * (light_space_depth < light_space_pos.z + .015 * (1 - dot(normal, l)));
+		float shadow = 1;
+		if (Features & FEATURE_SHADOW)
+		{
+			// points outside the light's view are lit
+			Vec3 light_space_pos = v4tov3(MVP_Shadow * bary_inter(payload.world, bar));
+			int sx = (int)light_space_pos.x, sy = (int)light_space_pos.y;
+			if (sx >= 0 && sx < width && sy >= 0 && sy < height)
+			{
+				float light_space_depth = shadowbuffer[sx * width + sy];
+				shadow = .3 + .7 * (light_space_depth < light_space_pos.z + .015 * (1 - dot(normal, l)));
+			}
+		}
 
 
 		result_color = (ambient + diffuse + specular) * 255.f;
@@ -351,37 +558,38 @@ struct BlinPhongShader : public IShader {
 	}
 };
 
-struct ShadowShader : public IShader {
-	Matrix MVP_Shadow;
+struct ShadowShader final : public ShaderBase<ShadowShader> {
+	Mat4 MVP_Shadow;
 
 	virtual Vec4 vertex(int iface, int nthvert)
 	{
 		payload.in_world[nthvert] = model->getVert(iface, nthvert);
-		payload.in_clip[nthvert] = mtov4(MVP * vtom(payload.in_world[nthvert]));
+		payload.in_clip[nthvert] = payload.vbuf->clip(model->vert_index(iface, nthvert));
 		payload.in_uv[nthvert] = model->getUV(iface, nthvert);
 		return payload.in_clip[nthvert];
 	}
 
-	virtual bool fragment(Vec3 bar, Vec2 _uv, TGAColor& color)
+	virtual bool fragment(Vec3 bar, TGAColor& color)
 	{
-		Vec3 light_space_pos = mtov3(MVP_Shadow * vtom(bary_inter(payload.world, bar)));
+		Vec3 light_space_pos = v4tov3(MVP_Shadow * bary_inter(payload.world, bar));
 		float light_space_depth = shadowbuffer[int(light_space_pos.x) * width + int(light_space_pos.y)];
 		float shadow = .3 + .7 * (light_space_depth < light_space_pos.z + .01);
-		Vec3 c = model->diffuse(_uv);
+		const interpolator_t& interp = payload.interp;
+		Vec3 c = model->diffuse(interp.uv(bar, interp.Z(bar)));
 		color = TGAColor(c.x * shadow, c.y * shadow, c.z * shadow);
 		return false;
 	}
 };
 
-struct DepthShader : public IShader {
+struct DepthShader final : public ShaderBase<DepthShader> {
 
 	virtual Vec4 vertex(int iface, int nthvert) {
 		payload.in_world[nthvert] = model->getVert(iface, nthvert);
-		payload.in_clip[nthvert] = mtov4(MVP * vtom(payload.in_world[nthvert]));
+		payload.in_clip[nthvert] = payload.vbuf->clip(model->vert_index(iface, nthvert));
 		return payload.in_clip[nthvert];
 	}
 
-	virtual bool fragment(Vec3 bar, Vec2 _uv, TGAColor& color) {
+	virtual bool fragment(Vec3 bar, TGAColor& color) {
 		Vec3 p = bary_inter(payload.world, bar);
 		int c = (1 + p.z) / 2 * 255;
 		color = TGAColor(c, c, c);
@@ -389,16 +597,92 @@ struct DepthShader : public IShader {
 	}
 };
 
+// draw the model with the permutation of Program that with_features picks, in the current view
+template<template<int> class Program>
+struct draw_model
+{
+	TGAImage& image;
+	float* zbuffer;
+	iblmap_t* iblmap;
+	Mat4 shadow_mvp;
+
+	template<typename Features>
+	void operator()(Features) const
+	{
+		Program<Features::value> shader;
+		shader.payload.iblmap = iblmap;
+
+		shader.MVP = Projection * ModelView;
+		shader.Viewport = Viewport;
+		shader.MVP_Shadow = shadow_mvp;
+
+		vertex_buffer_t vbuf;
+		transform_vertices(shader.MVP, *model, vbuf);
+		shader.payload.vbuf = &vbuf;
+
+		draw_mesh(image, zbuffer, shader, model->n_faces());
+	}
+};
+
 int main(int argc, char** argv) {
+	// "bench [file.tga]" times the texture layouts instead of rendering
+	if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+		texture_benchmark(argc > 2 ? argv[2] : "./obj/helmet/helmet_diffuse.tga");
+		return 0;
+	}
+	// "tgabench [file.tga]" times the tga decoder against the previous one
+	if (argc > 1 && strcmp(argv[1], "tgabench") == 0) {
+		tga_benchmark(argc > 2 ? argv[2] : "./obj/helmet/helmet_diffuse.tga");
+		return 0;
+	}
+	// "-compress" keeps the model textures block compressed, "-rpak file.rpak" renders from a bundle,
+	// "-blinnphong" shades with the shadow mapped Blinn-Phong shader instead of IBL
+	bool compress = false;
+	bool blinnphong = false;
+	const char* rpak = nullptr;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-compress") == 0)
+			compress = true;
+		if (strcmp(argv[i], "-rpak") == 0 && i + 1 < argc)
+			rpak = argv[++i];
+		if (strcmp(argv[i], "-blinnphong") == 0)
+			blinnphong = true;
+	}
+	// "pack [file.rpak]" loads the model and IBL maps and writes them as a bundle instead of rendering
+	if (argc > 1 && strcmp(argv[1], "pack") == 0) {
+		const char* out = argc > 2 && argv[2][0] != '-' ? argv[2] : "./obj/helmet.rpak";
+		model = new Model("./obj/helmet/helmet.obj", compress);
+		model->wait_maps();
+		iblmap_t* iblmap = load_ibl_map("./obj/common2");
+		bool ok = write_bundle(out, *model, *iblmap);
+		std::cout << (ok ? "packed " : "failed to write ") << out << "\n";
+		delete model;
+		return ok ? 0 : 1;
+	}
 
-	model = new Model("./obj/helmet/helmet.obj");
+	// the maps and the IBL maps load on loader_pool() while the shadow pass, which needs only the
+	// geometry, draws. A bundle is mapped and used in place, nothing is left to load.
+	auto t0 = std::chrono::steady_clock::now();
+	Bundle bundle;
+	std::future<iblmap_t*> ibl;
+	if (rpak) {
+		if (!bundle.open(rpak)) {
+			std::cerr << "can't open bundle " << rpak << "\n";
+			return 1;
+		}
+		model = bundle.get_model();
+	}
+	else {
+		model = new Model("./obj/helmet/helmet.obj", compress);
+		ibl = loader_pool().submit([]() { return load_ibl_map("./obj/common2"); });
+	}
 	shadowbuffer = new float[(width + 1) * (height + 1)];
 	float* zbuffer = new float[(width + 1) * (height + 1)];
 	for (int i = 0; i < width * height; i++) {
 		zbuffer[i] = shadowbuffer[i] = -std::numeric_limits<float>::max();
 	}
 
-	Matrix MV;
+	Mat4 MV;
 	{	// render shadow buffer
 		TGAImage depth(width, height, TGAImage::RGB);
 		lookat(light_dir, light_pos, up);
@@ -410,28 +694,36 @@ int main(int argc, char** argv) {
 		MV = Viewport * depthshader.MVP;
 		depthshader.Viewport = Viewport;
 
-		for (int i = 0; i < model->n_faces(); i++) {
-			draw_triangles(depth, shadowbuffer, depthshader, i);
-		}
+		vertex_buffer_t vbuf;
+		transform_vertices(depthshader.MVP, *model, vbuf);
+		depthshader.payload.vbuf = &vbuf;
+
+		draw_mesh(depth, shadowbuffer, depthshader, model->n_faces());
 		depth.flip_vertically();
 		depth.write_tga_file("depth.tga");
 	}
 
+	model->wait_maps();
+	iblmap_t* iblmap = rpak ? bundle.get_iblmap() : ibl.get();
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	std::cout << "assets ready and shadow pass drawn in " << secs * 1000 << " ms\n";
+
 	{	// render image
 		TGAImage image(width, height, TGAImage::RGB);
 		lookat(direction, eye_pos, up);
 		projection(frust);
 		viewport(width, height);
 
-		Shader shader;
-		load_ibl_map(shader.payload, "./obj/common2");
-
-		shader.MVP = Projection * ModelView;
-		shader.Viewport = Viewport;
-		shader.MVP_Shadow = MV;
-
-		for (int i = 0; i < model->n_faces(); i++) {
-			draw_triangles(image, zbuffer, shader, i);
+		if (blinnphong) {
+			draw_model<BlinPhongShader> draw = { image, zbuffer, iblmap, MV };
+			with_features<BLINPHONG_FEATURES>(material_features(*model), draw);
+		}
+		else {
+			// IBL shading is expensive, shade each visible pixel once
+			RenderState.depth_prepass = true;
+			draw_model<Shader> draw = { image, zbuffer, iblmap, MV };
+			with_features<PBR_FEATURES>(material_features(*model), draw);
+			RenderState.depth_prepass = false;
 		}
 
 		image.flip_vertically();
@@ -440,6 +732,8 @@ int main(int argc, char** argv) {
 
 	delete[] shadowbuffer;
 	delete[] zbuffer;
-	delete model;
+	// a bundle's model is deleted with the bundle
+	if (!rpak)
+		delete model;
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() : data_(nullptr), size_(0), opened_(false)
+#ifdef _WIN32
+	, file_(nullptr), mapping_(nullptr)
+#endif
+{
+}
+
+MappedFile::MappedFile(const char* filename) : MappedFile() {
+	open(filename);
+}
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+#ifdef _WIN32
+bool MappedFile::open(const char* filename) {
+	close();
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size)) {
+		CloseHandle(file);
+		return false;
+	}
+	file_ = file;
+	size_ = (size_t)size.QuadPart;
+	opened_ = true;
+	if (size_ == 0)
+		return true;
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping) {
+		close();
+		return false;
+	}
+	mapping_ = mapping;
+	data_ = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!data_) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close() {
+	if (data_) UnmapViewOfFile(data_);
+	if (mapping_) CloseHandle((HANDLE)mapping_);
+	if (file_) CloseHandle((HANDLE)file_);
+	data_ = nullptr;
+	mapping_ = nullptr;
+	file_ = nullptr;
+	size_ = 0;
+	opened_ = false;
+}
+#else
+bool MappedFile::open(const char* filename) {
+	close();
+	int fd = ::open(filename, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		::close(fd);
+		return false;
+	}
+	size_ = (size_t)st.st_size;
+	opened_ = true;
+	if (size_ > 0) {
+		void* p = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			::close(fd);
+			size_ = 0;
+			opened_ = false;
+			return false;
+		}
+		madvise(p, size_, MADV_SEQUENTIAL);
+		data_ = (const char*)p;
+	}
+	// the mapping stays valid after the descriptor is closed
+	::close(fd);
+	return true;
+}
+
+void MappedFile::close() {
+	if (data_) munmap((void*)data_, size_);
+	data_ = nullptr;
+	size_ = 0;
+	opened_ = false;
+}
+#endif
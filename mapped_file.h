@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+
+// read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+	MappedFile();
+	explicit MappedFile(const char* filename);
+	~MappedFile();
+
+	bool open(const char* filename);
+	void close();
+	bool is_open() const { return opened_; }
+	const char* data() const { return data_; }
+	size_t size() const { return size_; }
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+	const char* data_;
+	size_t size_;
+	bool opened_; // true for an opened empty file, which has no mapping
+#ifdef _WIN32
+	void* file_;
+	void* mapping_;
+#endif
+};
@@ -12,8 +12,8 @@ struct Vec2 {
 	float operator[](const int i) const { return i == 0 ? x : y; }
 	Vec2 operator*(const float t) const { return Vec2(x * t, y * t); }
 	Vec2 operator*(const Vec2& v2) const { return Vec2(x * v2.x, y * v2.y); }
-	Vec2 operator+(const Vec2& v2) { return Vec2(x + v2.x, y + v2.y); }
-	Vec2 operator-(const Vec2& v2) { return Vec2(x - v2.x, y - v2.y); }
+	Vec2 operator+(const Vec2& v2) const { return Vec2(x + v2.x, y + v2.y); }
+	Vec2 operator-(const Vec2& v2) const { return Vec2(x - v2.x, y - v2.y); }
 	float x, y;
 };
 
@@ -23,9 +23,9 @@ struct Vec3 {
 	float& operator[](const int i) { return i == 0 ? x : (i == 1 ? y : z); }
 	float operator[](const int i) const { return i == 0 ? x : (i == 1 ? y : z); }
 	Vec3 operator*(const float t) const { return Vec3(x * t, y * t, z * t); }
-	Vec3 operator+(const Vec3& v2) { return Vec3(x + v2.x, y + v2.y, z + v2.z); }
+	Vec3 operator+(const Vec3& v2) const { return Vec3(x + v2.x, y + v2.y, z + v2.z); }
 	Vec3 operator-(const Vec3& v2) { return Vec3(x - v2.x, y - v2.y, z - v2.z); }
-	Vec3 operator/(const float t) { return Vec3(x / t, y / t, z / t); }
+	Vec3 operator/(const float t) const { return Vec3(x / t, y / t, z / t); }
 	float norm_squared() const { return x * x + y * y + z * z; }
 	float x, y, z;
 };
@@ -34,9 +34,10 @@ struct Vec4 {
 	Vec4() : x(0), y(0), z(0), w(0) {}
 	Vec4(float _x, float _y, float _z, float _w) : x(_x), y(_y), z(_z), w(_w) {}
 	float& operator[](const int i) { return i == 0 ? x : (i == 1 ? y : (i == 2 ? z : w)); }
+	float operator[](const int i) const { return i == 0 ? x : (i == 1 ? y : (i == 2 ? z : w)); }
 	Vec4 operator*(const float t) const { return Vec4(x * t, y * t, z * t, w * t); }
-	Vec4 operator+(const Vec4& v2) { return Vec4(x + v2.x, y + v2.y, z + v2.z, w + v2.w); }
-	Vec4 operator-(const Vec4& v2) { return Vec4(x - v2.x, y - v2.y, z - v2.z, w - v2.w); }
+	Vec4 operator+(const Vec4& v2) const { return Vec4(x + v2.x, y + v2.y, z + v2.z, w + v2.w); }
+	Vec4 operator-(const Vec4& v2) const { return Vec4(x - v2.x, y - v2.y, z - v2.z, w - v2.w); }
 	float x, y, z, w;
 };
 
@@ -69,6 +70,82 @@ private:
 	float** data;
 };
 
+// 0, 1, ..., N - 1 as a parameter pack, for building a Mat element by element in one expression
+template<int... I>
+struct mat_indices {};
+
+template<int N, int... I>
+struct make_mat_indices : make_mat_indices<N - 1, N - 1, I...> {};
+
+template<int... I>
+struct make_mat_indices<0, I...>
+{
+	typedef mat_indices<I...> type;
+};
+
+// Fixed-size matrix, stored contiguously without heap allocation.
+// Aggregate type, so Mat4 m{} is a zero matrix. A constexpr Mat, eye() and reads through the const
+// operator[] can be used in constant expressions; C++11 constexpr members are const, so the
+// non-const operator[] is not.
+template<int R, int C>
+struct Mat
+{
+	float m[R][C];
+
+	float* operator[](const int i) { return m[i]; }
+	constexpr const float* operator[](const int i) const { return m[i]; }
+
+	Mat<C, R> transpose() const {
+		Mat<C, R> t{};
+		for (int i = 0; i < R; i++)
+			for (int j = 0; j < C; j++)
+				t[j][i] = m[i][j];
+		return t;
+	}
+
+	static constexpr Mat eye() {
+		return eye(typename make_mat_indices<R * C>::type());
+	}
+
+private:
+	// element I is row I / C, column I % C
+	template<int... I>
+	static constexpr Mat eye(mat_indices<I...>) {
+		return Mat{ { (I / C == I % C ? 1.f : 0.f)... } };
+	}
+};
+
+typedef Mat<4, 4> Mat4;
+
+template<int R, int N, int C>
+inline Mat<R, C> operator*(const Mat<R, N>& a, const Mat<N, C>& b) {
+	Mat<R, C> t{};
+	for (int i = 0; i < R; i++)
+		for (int k = 0; k < N; k++)
+			for (int j = 0; j < C; j++)
+				t[i][j] += a[i][k] * b[k][j];
+	return t;
+}
+
+inline Vec4 operator*(const Mat4& m, const Vec4& v) {
+	return Vec4(
+		m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z + m[0][3] * v.w,
+		m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z + m[1][3] * v.w,
+		m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z + m[2][3] * v.w,
+		m[3][0] * v.x + m[3][1] * v.y + m[3][2] * v.z + m[3][3] * v.w
+	);
+}
+
+// point transform, w = 1
+inline Vec4 operator*(const Mat4& m, const Vec3& v) {
+	return Vec4(
+		m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z + m[0][3],
+		m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z + m[1][3],
+		m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z + m[2][3],
+		m[3][0] * v.x + m[3][1] * v.y + m[3][2] * v.z + m[3][3]
+	);
+}
+
 inline float float_max(float a, float b)
 {
 	return a > b ? a : b;
@@ -129,6 +206,11 @@ Matrix vtom(const Vec4& v);
 
 Vec4 mtov4(const Matrix& m);
 
+// perspective division
+inline Vec3 v4tov3(const Vec4& v) {
+	return Vec3(v.x / v.w, v.y / v.w, v.z / v.w);
+}
+
 inline Vec4 bary_inter4(Vec4* v, Vec3 bar) {
 	return Vec4(
 		v[0][0] * bar.x + v[1][0] * bar.y + v[2][0] * bar.z,
@@ -1,126 +1,387 @@
 #include "model.h"
+#include "mapped_file.h"
+#include "parallel.h"
 #include <io.h> 
+#include <unordered_map>
+#include <chrono>
+#include <cstring>
+#include <climits>
 
-Model::Model(const char* filename) :verts(), uvs(), norms(), faces() {
+namespace {
+	// key of one vertex: position / uv / normal index in the obj file, -1 when absent
+	struct corner_key {
+		int v, vt, vn;
+		bool operator==(const corner_key& k) const { return v == k.v && vt == k.vt && vn == k.vn; }
+	};
+
+	struct corner_hash {
+		size_t operator()(const corner_key& k) const {
+			size_t h = (size_t)k.v * 73856093u;
+			h ^= (size_t)k.vt * 19349663u;
+			h ^= (size_t)k.vn * 83492791u;
+			return h;
+		}
+	};
+
+	// index of an attribute a corner does not give, an index of 0 in the file is out of range instead
+	const int obj_missing = INT_MIN;
+
+	// face corner as parsed from one chunk. Negative obj indices are relative to the attributes read so far,
+	// they are resolved against the chunk-local count and flagged in `rel` so the merge can add the chunk base.
+	struct obj_corner {
+		int idx[3];
+		unsigned char rel;
+	};
+
+	struct obj_chunk {
+		std::vector<Vec3> verts;
+		std::vector<Vec2> uvs;
+		std::vector<Vec3> norms;
+		std::vector<obj_corner> corners;
+		std::vector<int> face_sizes;
+		size_t lines = 0;
+	};
+
+	const double pow10_table[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	inline bool is_digit(char c) {
+		return (unsigned)(c - '0') < 10u;
+	}
+
+	inline const char* skip_space(const char* p, const char* end) {
+		while (p < end && (*p == ' ' || *p == '\t'))
+			p++;
+		return p;
+	}
+
+	const char* parse_float(const char* p, const char* end, float& out) {
+		p = skip_space(p, end);
+		bool neg = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			neg = *p++ == '-';
+
+		// up to 19 significant digits go into the mantissa, the rest only moves the exponent
+		uint64_t mant = 0;
+		int digits = 0, exp10 = 0;
+		for (; p < end && is_digit(*p); p++) {
+			if (digits < 19) {
+				mant = mant * 10 + (*p - '0');
+				digits += mant != 0;
+			}
+			else exp10++;
+		}
+		if (p < end && *p == '.') {
+			for (p++; p < end && is_digit(*p); p++) {
+				if (digits < 19) {
+					mant = mant * 10 + (*p - '0');
+					digits += mant != 0;
+					exp10--;
+				}
+			}
+		}
+		if (p < end && (*p == 'e' || *p == 'E')) {
+			const char* q = p + 1;
+			bool eneg = false;
+			if (q < end && (*q == '-' || *q == '+'))
+				eneg = *q++ == '-';
+			if (q < end && is_digit(*q)) {
+				int e = 0;
+				for (; q < end && is_digit(*q); q++)
+					e = e < 10000 ? e * 10 + (*q - '0') : e;
+				exp10 += eneg ? -e : e;
+				p = q;
+			}
+		}
+
+		double v = (double)mant;
+		if (exp10 < 0)
+			v = exp10 >= -22 ? v / pow10_table[-exp10] : v * std::pow(10.0, exp10);
+		else if (exp10 > 0)
+			v = exp10 <= 22 ? v * pow10_table[exp10] : v * std::pow(10.0, exp10);
+		out = (float)(neg ? -v : v);
+		return p;
+	}
+
+	const char* parse_int(const char* p, const char* end, int& out) {
+		bool neg = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			neg = *p++ == '-';
+		// saturates at INT_MAX, out of range of any vertex, instead of wrapping to a valid index
+		int v = 0;
+		for (; p < end && is_digit(*p); p++)
+			v = v > (INT_MAX - 9) / 10 ? INT_MAX : v * 10 + (*p - '0');
+		out = neg ? -v : v;
+		return p;
+	}
+
+	// parse complete lines in [p, end)
+	void parse_chunk(const char* p, const char* end, obj_chunk& c) {
+		while (p < end) {
+			const char* eol = (const char*)memchr(p, '\n', end - p);
+			if (!eol) eol = end;
+			c.lines++;
+
+			const char* s = skip_space(p, eol);
+			if (eol - s >= 2 && s[0] == 'v' && s[1] == ' ') {
+				Vec3 ve;
+				s = parse_float(s + 2, eol, ve.x);
+				s = parse_float(s, eol, ve.y);
+				parse_float(s, eol, ve.z);
+				c.verts.push_back(ve);
+			}
+			else if (eol - s >= 3 && s[0] == 'v' && s[1] == 't' && s[2] == ' ') {
+				Vec2 ve;
+				s = parse_float(s + 3, eol, ve.x);
+				parse_float(s, eol, ve.y);
+				c.uvs.push_back(Vec2(fmod(ve.x, 1), fmod(ve.y, 1)));
+			}
+			else if (eol - s >= 3 && s[0] == 'v' && s[1] == 'n' && s[2] == ' ') {
+				Vec3 ve;
+				s = parse_float(s + 3, eol, ve.x);
+				s = parse_float(s, eol, ve.y);
+				parse_float(s, eol, ve.z);
+				c.norms.push_back(ve);
+			}
+			else if (eol - s >= 2 && s[0] == 'f' && s[1] == ' ') {
+				// v, v/vt, v//vn or v/vt/vn
+				const int counts[3] = { (int)c.verts.size(), (int)c.uvs.size(), (int)c.norms.size() };
+				int n = 0;
+				for (s += 2;; n++) {
+					s = skip_space(s, eol);
+					if (s >= eol || !(is_digit(*s) || *s == '-'))
+						break;
+					obj_corner k = { { obj_missing, obj_missing, obj_missing }, 0 };
+					for (int i = 0; i < 3; i++) {
+						if (i > 0) {
+							if (s >= eol || *s != '/') break;
+							s++;
+							if (s < eol && *s == '/') continue;
+						}
+						int v;
+						s = parse_int(s, eol, v);
+						if (v < 0) {
+							k.idx[i] = counts[i] + v;
+							k.rel |= 1 << i;
+						}
+						else k.idx[i] = v - 1;
+					}
+					c.corners.push_back(k);
+				}
+				c.face_sizes.push_back(n);
+			}
+			p = eol + 1;
+		}
+	}
+}
+
+Model::Model(const char* filename, bool compress_textures) :verts(), uvs(), norms(), indices(),
+	vert_data(nullptr), uv_data(nullptr), norm_data(nullptr), index_data(nullptr), nverts(0), nindices(0), compressed(compress_textures) {
 
 	diffusemap_ = NULL;
 	normalmap_ = NULL;
 	specularmap_ = NULL;
-	roughnessmap_ = NULL;
-	metalnessmap_ = NULL;
-	occlusion_map = NULL;
+	material_map = NULL;
+	has_occlusion = false;
 	emision_map = NULL;
 
-	std::ifstream f;
-	f.open(filename, std::ifstream::in);
-	if (f.fail()) return;
-
-	std::string line;
-	while (!f.eof()) {
-		std::getline(f, line);
-		std::stringstream sstr(line);
-		char waste;
-
-		if (!line.compare(0, 2, "v ")) {
-			sstr >> waste;
-			Vec3 ve(0, 0, 0);
-			sstr >> ve.x;
-			sstr >> ve.y;
-			sstr >> ve.z;
-			verts.push_back(ve);
-		}
-		else if (!line.compare(0, 3, "vt ")) {
-			sstr >> waste >> waste;
-			Vec3 ve(0, 0, 0);
-			sstr >> ve.x;
-			sstr >> ve.y;
-			uvs.push_back(ve);
-		}
-		else if (!line.compare(0, 3, "vn ")) {
-			sstr >> waste >> waste;
-			Vec3 ve(0, 0, 0);
-			sstr >> ve.x;
-			sstr >> ve.y;
-			sstr >> ve.z;
-			norms.push_back(ve);
-		}
-		else if (!line.compare(0, 2, "f ")) {
-			sstr >> waste;
-			std::vector<Vec3> onef;
-			Vec3 ve(0, 0, 0);
-			while (sstr >> ve.x >> waste >> ve.y >> waste >> ve.z) {
-				ve.x--;
-				ve.y--;
-				ve.z--;
-				onef.push_back(ve);
+	auto t0 = std::chrono::steady_clock::now();
+	MappedFile file(filename);
+	if (!file.is_open()) return;
+
+	// split the file into line-aligned chunks (at least 1MB each) which are parsed concurrently
+	const char* text = file.data();
+	size_t size = file.size();
+	int nchunk = (int)std::min<size_t>(worker_count(), size / (1 << 20) + 1);
+	std::vector<const char*> bounds(nchunk + 1);
+	bounds[0] = text;
+	bounds[nchunk] = text + size;
+	for (int i = 1; i < nchunk; i++) {
+		const char* p = text + size * i / nchunk;
+		p = std::max(p, bounds[i - 1]);
+		const char* eol = (const char*)memchr(p, '\n', text + size - p);
+		bounds[i] = eol ? eol + 1 : text + size;
+	}
+
+	std::vector<obj_chunk> chunks(nchunk);
+	parallel_for(0, nchunk, 1, [&](int begin, int end) {
+		for (int i = begin; i < end; i++)
+			parse_chunk(bounds[i], bounds[i + 1], chunks[i]);
+	});
+
+	// merge in file order: resolve relative indices, then flatten unique v/vt/vn triplets into the vertex buffer
+	std::vector<Vec3> obj_verts;
+	std::vector<Vec2> obj_uvs;
+	std::vector<Vec3> obj_norms;
+	std::vector<int> bases(nchunk * 3);
+	size_t lines = 0, ncorner = 0;
+	for (int i = 0; i < nchunk; i++) {
+		bases[i * 3 + 0] = (int)obj_verts.size();
+		bases[i * 3 + 1] = (int)obj_uvs.size();
+		bases[i * 3 + 2] = (int)obj_norms.size();
+		obj_verts.insert(obj_verts.end(), chunks[i].verts.begin(), chunks[i].verts.end());
+		obj_uvs.insert(obj_uvs.end(), chunks[i].uvs.begin(), chunks[i].uvs.end());
+		obj_norms.insert(obj_norms.end(), chunks[i].norms.begin(), chunks[i].norms.end());
+		lines += chunks[i].lines;
+		ncorner += chunks[i].corners.size();
+	}
+	const int sizes[3] = { (int)obj_verts.size(), (int)obj_uvs.size(), (int)obj_norms.size() };
+
+	std::unordered_map<corner_key, uint32_t, corner_hash> vertex_of;
+	vertex_of.reserve(ncorner / 2);
+	indices.reserve(ncorner);
+	std::vector<corner_key> keys;
+	std::vector<uint32_t> face;
+	for (int c = 0; c < nchunk; c++) {
+		const obj_chunk& chunk = chunks[c];
+		const obj_corner* corner = chunk.corners.data();
+		for (int n : chunk.face_sizes) {
+			// resolve and check every corner first, a face with a bad corner adds no vertices
+			keys.clear();
+			bool valid = true;
+			for (int i = 0; i < n; i++, corner++) {
+				int idx[3];
+				for (int a = 0; a < 3; a++) {
+					bool rel = (corner->rel >> a) & 1;
+					bool missing = corner->idx[a] == obj_missing && !rel;
+					idx[a] = missing ? -1 : corner->idx[a] + (rel ? bases[c * 3 + a] : 0);
+					if (missing ? a == 0 : (idx[a] < 0 || idx[a] >= sizes[a]))
+						valid = false;
+				}
+				corner_key k = { idx[0], idx[1], idx[2] };
+				keys.push_back(k);
+			}
+			if (!valid)
+				continue;
+
+			face.clear();
+			for (const corner_key& k : keys) {
+				auto it = vertex_of.find(k);
+				if (it == vertex_of.end()) {
+					it = vertex_of.emplace(k, (uint32_t)verts.size()).first;
+					verts.push_back(obj_verts[k.v]);
+					uvs.push_back(k.vt >= 0 ? obj_uvs[k.vt] : Vec2(0, 0));
+					norms.push_back(k.vn >= 0 ? obj_norms[k.vn] : Vec3(0, 0, 0));
+				}
+				face.push_back(it->second);
+			}
+			// polygons are split into a triangle fan
+			for (size_t i = 2; i < face.size(); i++) {
+				indices.push_back(face[0]);
+				indices.push_back(face[i - 1]);
+				indices.push_back(face[i]);
 			}
-			faces.push_back(onef);
 		}
 	}
-	std::cout << "read Model:" << filename << "\n";
+
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	double mb = size / (1024.0 * 1024.0);
+	secs = std::max(secs, 1e-9);
+	std::cout << "read Model:" << filename << " (" << lines << " lines, " << mb << " MB in " << secs * 1000 << " ms, "
+		<< lines / secs / 1e6 << " Mlines/s, " << mb / secs << " MB/s)\n";
+	vert_data = verts.data();
+	uv_data = uvs.data();
+	norm_data = norms.data();
+	index_data = indices.data();
+	nverts = (int)verts.size();
+	nindices = (int)indices.size();
 	create_map(filename);
 }
 
+Model::Model(const model_view_t& view) :
+	vert_data(view.verts), uv_data(view.uvs), norm_data(view.norms), index_data(view.indices),
+	nverts(view.n_verts), nindices(view.n_indices), compressed(false) {
+	diffusemap_ = view.diffuse;
+	normalmap_ = view.normal;
+	specularmap_ = view.specular;
+	material_map = view.material;
+	has_occlusion = view.has_occlusion;
+	emision_map = view.emission;
+}
+
 Model::~Model() {
+	wait_maps();
 	delete diffusemap_;
 	delete normalmap_;
 	delete specularmap_;
-	delete roughnessmap_;
-	delete metalnessmap_;
-	delete occlusion_map;
+	delete material_map;
 	delete emision_map;
 }
 
-int Model::n_faces() {
-	return faces.size();
+int Model::n_faces() const {
+	return nindices / 3;
 }
 
-Vec3 Model::getVert(int iface, int nthVert) {
-	int nth = faces[iface][nthVert][0];
-	return verts[nth];
+int Model::n_verts() const {
+	return nverts;
 }
 
-Vec3 Model::getNorm(int iface, int nthVert) {
-	int nth = faces[iface][nthVert][2];
-	return norms[nth];
+std::vector<int> Model::getFace(int i) const {
+	return std::vector<int>(index_data + i * 3, index_data + i * 3 + 3);
 }
 
-Vec2 Model::getUV(int iface, int nthVert) {
-	int nth = faces[iface][nthVert][1];
-	uvs[nth].x = fmod(uvs[nth].x, 1);
-	uvs[nth].y = fmod(uvs[nth].y, 1);
-	return Vec2(uvs[nth].x, uvs[nth].y);
+bool Model::load_image(std::string filename, const char* suffix, TGAImage& img) {
+	std::string texfile(filename);
+	size_t dot = texfile.find_last_of(".");
+	if (dot == std::string::npos)
+		return false;
+	texfile = texfile.substr(0, dot) + std::string(suffix);
+	if (_access(texfile.data(), 0) == -1)
+		return false;
+	bool ok = img.read_tga_file(texfile.c_str(), true);
+	// one write per line, maps load on several threads
+	std::cerr << ("texture file " + texfile + " loading " + (ok ? "ok" : "failed") + "\n");
+	return ok;
 }
 
-std::vector<int> Model::getFace(int i) {
-	std::vector<int> t;
-	for (Vec3& ve : faces[i]) {
-		t.push_back(ve.x);
-		t.push_back(ve.y);
-		t.push_back(ve.z);
-	}
-	return t;
+Texture* Model::load_texture(std::string filename, const char* suffix, texture_format format) {
+	TGAImage img;
+	if (!load_image(filename, suffix, img))
+		return nullptr;
+	return new Texture(img, true, compressed ? format : TEXTURE_RGBA8);
 }
 
-void Model::load_texture(std::string filename, const char* suffix, TGAImage& img) {
-	std::string texfile(filename);
-	size_t dot = texfile.find_last_of(".");
-	if (dot != std::string::npos) {
-		texfile = texfile.substr(0, dot) + std::string(suffix);
-		std::cerr << "texture file " << texfile << " loading " << (img.read_tga_file(texfile.c_str()) ? "ok" : "failed") << std::endl;
-		img.flip_vertically();
+// pack the grayscale occlusion, roughness and metalness maps into the r, g and b of one texture,
+// at the largest of their sizes. Missing maps are filled with no occlusion, rough and dielectric.
+// It stays RGBA8 when compressing: BC1 fits one color line through r, g and b, which would bleed
+// the unrelated channels into each other.
+Texture* Model::pack_material(std::string filename) {
+	const char* suffixes[3] = { "_occlusion.tga", "_roughness.tga", "_metalness.tga" };
+	const unsigned char fill[3] = { 255, 255, 0 };
+	TGAImage src[3];
+	bool found[3];
+	int width = 0, height = 0;
+	for (int c = 0; c < 3; c++) {
+		found[c] = load_image(filename, suffixes[c], src[c]);
+		if (found[c]) {
+			width = std::max(width, src[c].get_width());
+			height = std::max(height, src[c].get_height());
+		}
 	}
-}
+	if (!width || !height)
+		return nullptr;
+	has_occlusion = found[0];
 
-void Model::load_texture(std::string filename, const char* suffix, TGAImage* img) {
-	std::string texfile(filename);
-	size_t dot = texfile.find_last_of(".");
-	if (dot != std::string::npos) {
-		texfile = texfile.substr(0, dot) + std::string(suffix);
-		std::cerr << "texture file " << texfile << " loading " << (img->read_tga_file(texfile.c_str()) ? "ok" : "failed") << std::endl;
-		//img->read_tga_file(texfile.c_str());
-		img->flip_vertically();
+	TGAImage packed(width, height, TGAImage::RGB);
+	unsigned char* dst = packed.buffer();
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++, dst += 3) {
+			for (int c = 0; c < 3; c++) {
+				unsigned char v = fill[c];
+				if (found[c]) {
+					// gray, or the blue of a color map, is the first byte of a tga pixel
+					int sx = (int)((long long)x * src[c].get_width() / width);
+					int sy = (int)((long long)y * src[c].get_height() / height);
+					v = src[c].buffer()[((size_t)sy * src[c].get_width() + sx) * src[c].get_bytespp()];
+				}
+				// tga stores b, g, r
+				dst[2 - c] = v;
+			}
+		}
 	}
+	return new Texture(packed, true, TEXTURE_RGBA8);
 }
 
 void Model::create_map(const char* filename)
@@ -128,134 +389,79 @@ void Model::create_map(const char* filename)
 	diffusemap_ = NULL;
 	normalmap_ = NULL;
 	specularmap_ = NULL;
-	roughnessmap_ = NULL;
-	metalnessmap_ = NULL;
-	occlusion_map = NULL;
+	material_map = NULL;
+	has_occlusion = false;
 	emision_map = NULL;
 
+	// every map is read and decoded on its own pool job, a missing file leaves its map NULL
+	std::string name(filename);
+	ThreadPool& pool = loader_pool();
+	map_loads.push_back(pool.submit([this, name]() {
+		diffusemap_ = load_texture(name, "_diffuse.tga", TEXTURE_BC1);
+	}));
+	map_loads.push_back(pool.submit([this, name]() {
+		normalmap_ = load_texture(name, "_normal.tga", TEXTURE_BC5);
+	}));
+	map_loads.push_back(pool.submit([this, name]() {
+		specularmap_ = load_texture(name, "_spec.tga", TEXTURE_BC4);
+	}));
+	map_loads.push_back(pool.submit([this, name]() {
+		emision_map = load_texture(name, "_emission.tga", TEXTURE_BC1);
+	}));
+	// a pre-packed _orm.tga is used as is, otherwise the separate maps are packed at load
+	map_loads.push_back(pool.submit([this, name]() {
+		material_map = load_texture(name, "_orm.tga", TEXTURE_RGBA8);
+		if (material_map)
+			has_occlusion = true;
+		else
+			material_map = pack_material(name);
+	}));
+}
 
-	std::string texfile(filename);
-	size_t dot = texfile.find_last_of(".");
-
-	texfile = texfile.substr(0, dot) + std::string("_diffuse.tga");
-	if (_access(texfile.data(), 0) != -1)
-	{
-		diffusemap_ = new TGAImage();
-		load_texture(filename, "_diffuse.tga", diffusemap_);
-	}
-
-	texfile = texfile.substr(0, dot) + std::string("_normal.tga");
-	if (_access(texfile.data(), 0) != -1)
-	{
-		normalmap_ = new TGAImage();
-		load_texture(filename, "_normal.tga", normalmap_);
-	}
-
-	texfile = texfile.substr(0, dot) + std::string("_spec.tga");
-	if (_access(texfile.data(), 0) != -1)
-	{
-		specularmap_ = new TGAImage();
-		load_texture(filename, "_spec.tga", specularmap_);
-	}
-
-	texfile = texfile.substr(0, dot) + std::string("_roughness.tga");
-	if (_access(texfile.data(), 0) != -1)
-	{
-		roughnessmap_ = new TGAImage();
-		load_texture(filename, "_roughness.tga", roughnessmap_);
-	}
-
-	texfile = texfile.substr(0, dot) + std::string("_metalness.tga");
-	if (_access(texfile.data(), 0) != -1)
-	{
-		metalnessmap_ = new TGAImage();
-		load_texture(filename, "_metalness.tga", metalnessmap_);
-	}
-
-	texfile = texfile.substr(0, dot) + std::string("_emission.tga");
-	if (_access(texfile.data(), 0) != -1)
-	{
-		emision_map = new TGAImage();
-		load_texture(filename, "_emission.tga", emision_map);
-	}
-
-	texfile = texfile.substr(0, dot) + std::string("_occlusion.tga");
-	if (_access(texfile.data(), 0) != -1)
-	{
-		occlusion_map = new TGAImage();
-		load_texture(filename, "_occlusion.tga", occlusion_map);
-	}
-	0;
+void Model::wait_maps()
+{
+	for (std::future<void>& f : map_loads)
+		f.get();
+	map_loads.clear();
 }
 
-Vec3 Model::diffuse(Vec2 uv)
+Vec3 Model::diffuse(Vec2 uv, float uv_lod) const
 {
-	uv[0] = fmod(uv[0], 1);
-	uv[1] = fmod(uv[1], 1);
-	int uv0 = uv[0] * diffusemap_->get_width();
-	int uv1 = uv[1] * diffusemap_->get_height();
-	TGAColor c = diffusemap_->get(uv0, uv1);
-	Vec3 res;
-	for (int i = 0; i < 3; i++)
-		res[2 - i] = (float)c[i] / 255.f;
-	return res;
+	return diffusemap_->sample_lod(uv, uv_lod);
+}
+
+Vec3 Model::normal(Vec2 uv) const {
+	Vec3 c = normalmap_->sample(uv);
+	//because the normap_map coordinate is -1 ~ +1
+	return Vec3(c.x * 2.f - 1.f, c.y * 2.f - 1.f, c.z * 2.f - 1.f);
 }
 
-Vec3 Model::normal(Vec2 uv) {
-	uv[0] = fmod(uv[0], 1);
-	uv[1] = fmod(uv[1], 1);
-	int uv0 = uv[0] * normalmap_->get_width();
-	int uv1 = uv[1] * normalmap_->get_height();
-	TGAColor c = normalmap_->get(uv0, uv1);
-	Vec3 res;
-	for (int i = 0; i < 3; i++)
-		res[2 - i] = (float)c[i] / 255.f * 2.f - 1.f; //because the normap_map coordinate is -1 ~ +1
-	return res;
+Vec3 Model::material(Vec2 uv, float uv_lod) const
+{
+	return material_map->sample_lod(uv, uv_lod);
 }
 
-float Model::roughness(Vec2 uv) {
-	uv[0] = fmod(uv[0], 1);
-	uv[1] = fmod(uv[1], 1);
-	int uv0 = uv[0] * roughnessmap_->get_width();
-	int uv1 = uv[1] * roughnessmap_->get_height();
-	return roughnessmap_->get(uv0, uv1)[0] / 255.f;
+float Model::roughness(Vec2 uv, float uv_lod) const {
+	return material_map->sample_lod(uv, uv_lod, 1);
 }
 
-float Model::metalness(Vec2 uv) {
-	uv[0] = fmod(uv[0], 1);
-	uv[1] = fmod(uv[1], 1);
-	int uv0 = uv[0] * metalnessmap_->get_width();
-	int uv1 = uv[1] * metalnessmap_->get_height();
-	return metalnessmap_->get(uv0, uv1)[0] / 255.f;
+float Model::metalness(Vec2 uv, float uv_lod) const {
+	return material_map->sample_lod(uv, uv_lod, 2);
 }
 
-float Model::specular(Vec2 uv) {
-	int uv0 = uv[0] * specularmap_->get_width();
-	int uv1 = uv[1] * specularmap_->get_height();
-	return specularmap_->get(uv0, uv1)[0] / 1.f;
+float Model::specular(Vec2 uv) const {
+	return specularmap_->texel(uv)[2] / 1.f;
 }
 
-float Model::occlusion(Vec2 uv) {
-	if (!occlusion_map)
+float Model::occlusion(Vec2 uv, float uv_lod) const {
+	if (!has_occlusion)
 		return 1;
-	uv[0] = fmod(uv[0], 1);
-	uv[1] = fmod(uv[1], 1);
-	int uv0 = uv[0] * occlusion_map->get_width();
-	int uv1 = uv[1] * occlusion_map->get_height();
-	return occlusion_map->get(uv0, uv1)[0] / 255.f;
+	return material_map->sample_lod(uv, uv_lod, 0);
 }
 
-Vec3 Model::emission(Vec2 uv)
+Vec3 Model::emission(Vec2 uv, float uv_lod) const
 {
-	if (!occlusion_map)
+	if (!emision_map)
 		return Vec3(0.0f, 0.0f, 0.0f);
-	uv[0] = fmod(uv[0], 1);
-	uv[1] = fmod(uv[1], 1);
-	int uv0 = uv[0] * emision_map->get_width();
-	int uv1 = uv[1] * emision_map->get_height();
-	TGAColor c = emision_map->get(uv0, uv1);
-	Vec3 res;
-	for (int i = 0; i < 3; i++)
-		res[2 - i] = (float)c[i] / 255.f;
-	return res;
+	return emision_map->sample_lod(uv, uv_lod);
 }
@@ -4,39 +4,81 @@
 #include <sstream>
 #include <vector>
 #include <string>
-#include "tgaimage.h"
+#include <cstdint>
+#include <future>
+#include "texture.h"
 #include "matrix.h"
 
+// the arrays and maps of a model stored elsewhere, see bundle.h. The arrays are not copied and
+// must outlive the Model, the maps are owned by it.
+typedef struct
+{
+	int n_verts, n_indices;
+	const Vec3* verts;
+	const Vec2* uvs;
+	const Vec3* norms;
+	const uint32_t* indices;
+	Texture* diffuse;
+	Texture* normal;
+	Texture* specular;
+	Texture* material;
+	Texture* emission;
+	bool has_occlusion;
+} model_view_t;
+
 class Model
 {
 private:
+	// one entry per unique v/vt/vn triplet, indexed by `indices` (3 per triangle), as parsed
 	std::vector<Vec3> verts;
-	std::vector<Vec3> uvs;
+	std::vector<Vec2> uvs;
 	std::vector<Vec3> norms;
-	std::vector<std::vector<Vec3>> faces;
-	void load_texture(std::string filename, const char* suffix, TGAImage& img);
-	void load_texture(std::string filename, const char* suffix, TGAImage* img);
+	std::vector<uint32_t> indices;
+	// the arrays in use, over the vectors above or over the memory of a model_view_t
+	const Vec3* vert_data;
+	const Vec2* uv_data;
+	const Vec3* norm_data;
+	const uint32_t* index_data;
+	int nverts, nindices;
+	bool load_image(std::string filename, const char* suffix, TGAImage& img);
+	bool compressed; // block compress the maps, in the format each load_texture call names
+	Texture* load_texture(std::string filename, const char* suffix, texture_format format);
+	Texture* pack_material(std::string filename);
 	void create_map(const char* filename);
+	std::vector<std::future<void>> map_loads; // one per map, each sets its own member
 public:
-	TGAImage* diffusemap_;
-	TGAImage* normalmap_;
-	TGAImage* specularmap_;
-	TGAImage* roughnessmap_;
-	TGAImage* metalnessmap_;
-	TGAImage* occlusion_map;
-	TGAImage* emision_map;
-	int n_faces();
-	Vec3 getVert(int iface, int nthVert);
-	Vec2 getUV(int iface, int nthVert);
-	Vec3 getNorm(int iface, int nthVert);
-	std::vector<int> getFace(int idx);
-	Vec3 diffuse(Vec2 uv);
-	Vec3 normal(Vec2 uv);
-	float roughness(Vec2 uv);
-	float metalness(Vec2 uv);
-	Vec3 emission(Vec2 uv);
-	float occlusion(Vec2 uv);
-	float specular(Vec2 uv);
-	Model(const char* filename);
+	Texture* diffusemap_;
+	Texture* normalmap_;
+	Texture* specularmap_;
+	// r = occlusion, g = roughness, b = metalness
+	Texture* material_map;
+	bool has_occlusion;
+	Texture* emision_map;
+	int n_faces() const;
+	int n_verts() const;
+	// n_verts() entries each, and 3 * n_faces() indices
+	const Vec3* vertices() const { return vert_data; }
+	const Vec2* texcoords() const { return uv_data; }
+	const Vec3* normals() const { return norm_data; }
+	const uint32_t* face_indices() const { return index_data; }
+	int vert_index(int iface, int nthVert) const { return index_data[iface * 3 + nthVert]; }
+	Vec3 getVert(int iface, int nthVert) const { return vert_data[vert_index(iface, nthVert)]; }
+	Vec2 getUV(int iface, int nthVert) const { return uv_data[vert_index(iface, nthVert)]; }
+	Vec3 getNorm(int iface, int nthVert) const { return norm_data[vert_index(iface, nthVert)]; }
+	std::vector<int> getFace(int idx) const;
+	Vec3 diffuse(Vec2 uv, float uv_lod = TEXTURE_BASE_LOD) const;
+	Vec3 normal(Vec2 uv) const;
+	// occlusion, roughness, metalness in one fetch
+	Vec3 material(Vec2 uv, float uv_lod = TEXTURE_BASE_LOD) const;
+	float roughness(Vec2 uv, float uv_lod = TEXTURE_BASE_LOD) const;
+	float metalness(Vec2 uv, float uv_lod = TEXTURE_BASE_LOD) const;
+	Vec3 emission(Vec2 uv, float uv_lod = TEXTURE_BASE_LOD) const;
+	float occlusion(Vec2 uv, float uv_lod = TEXTURE_BASE_LOD) const;
+	float specular(Vec2 uv) const;
+	// the geometry is ready on return, the maps are still decoding on loader_pool()
+	Model(const char* filename, bool compress_textures = false);
+	explicit Model(const model_view_t& view);
 	~Model();
+	// block until every map is loaded, the map members are only valid after this
+	void wait_maps();
 };
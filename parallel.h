@@ -0,0 +1,119 @@
+#pragma once
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+inline int worker_count()
+{
+	unsigned n = std::thread::hardware_concurrency();
+	return n == 0 ? 1 : (int)n;
+}
+
+// run fn(begin, end) over [first, last) in chunks of `grain`, chunks are handed out dynamically
+// to one thread per core. Small ranges run inline on the calling thread.
+template<typename F>
+void parallel_for(int first, int last, int grain, F fn)
+{
+	if (last <= first)
+		return;
+	grain = std::max(grain, 1);
+	int nchunk = (last - first + grain - 1) / grain;
+	int nthread = std::min(worker_count(), nchunk);
+	if (nthread <= 1) {
+		fn(first, last);
+		return;
+	}
+
+	std::atomic<int> next(0);
+	auto work = [&]() {
+		for (int c = next++; c < nchunk; c = next++) {
+			int begin = first + c * grain;
+			fn(begin, std::min(begin + grain, last));
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int i = 1; i < nthread; i++)
+		threads.emplace_back(work);
+	work();
+	for (std::thread& t : threads)
+		t.join();
+}
+
+// a fixed set of worker threads running queued jobs in submit order, submit returns a future of
+// the job's result. Jobs must not wait on futures of the same pool, only outside threads do.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(int threads)
+	{
+		for (int i = 0; i < threads; i++)
+			workers.emplace_back([this]() { run(); });
+	}
+
+	// queued jobs still run before the workers exit
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread& t : workers)
+			t.join();
+	}
+
+	template<typename F>
+	auto submit(F fn) -> std::future<decltype(fn())>
+	{
+		typedef decltype(fn()) R;
+		auto task = std::make_shared<std::packaged_task<R()>>(fn);
+		std::future<R> result = task->get_future();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back([task]() { (*task)(); });
+		}
+		wake.notify_one();
+		return result;
+	}
+
+private:
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+
+	void run()
+	{
+		for (;;) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+				if (jobs.empty())
+					return;
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+			job();
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+};
+
+// the pool file reads and texture decodes run on, one worker per core, created on first use
+inline ThreadPool& loader_pool()
+{
+	static ThreadPool pool(worker_count());
+	return pool;
+}
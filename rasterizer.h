@@ -0,0 +1,329 @@
+#pragma once
+#include "graphic.h"
+#include "parallel.h"
+#include <memory>
+
+// Rasterizer templates. Drawing with a concrete (final) shader type binds the per-pixel shader calls
+// statically; graphic.h declares the same entry points for IShader&, which dispatch virtually.
+
+typedef enum {
+	RASTER_SHADE,		// depth test, then shade and write depth and color
+	RASTER_DEPTH_ONLY,	// depth pre-pass, only writes depth and the triangle that wrote it
+	RASTER_SHADE_EQUAL	// after the pre-pass, shade the fragments of the triangle that kept its depth
+} raster_mode;
+
+// screen rectangle [x0, x1) x [y0, y1)
+struct rect_t
+{
+	int x0, y0, x1, y1;
+};
+
+// clipped triangle in screen space with the attributes of its three vertices
+struct raster_tri_t
+{
+	Vec3 screen[3];
+	Vec4 clip[3];
+	Vec3 world[3];
+	Vec3 normal[3];
+	Vec2 uv[3];
+};
+
+// assembled triangles of a contiguous range of faces, and their indices binned per screen tile
+struct geometry_chunk_t
+{
+	std::vector<raster_tri_t> tris;
+	std::vector<std::vector<uint32_t>> bins;
+};
+
+// orientation of a triangle from clip space, valid before clipping and perspective division.
+// |x y w| is the screen space signed area times w0 * w1 * w2, visible vertices have w < 0,
+// so the determinant of a front face is negative. Triangles crossing w = 0 get the orientation
+// they have as seen from the eye.
+inline float clip_space_det(float x0, float y0, float w0, float x1, float y1, float w1,
+	float x2, float y2, float w2)
+{
+	return x0 * (y1 * w2 - y2 * w1) - y0 * (x1 * w2 - x2 * w1) + w0 * (x1 * y2 - x2 * y1);
+}
+
+inline bool is_culled(float det)
+{
+	switch (RenderState.cull)
+	{
+	case CULL_BACK:
+		return det >= 0;
+	case CULL_FRONT:
+		return det <= 0;
+	default:
+		return false;
+	}
+}
+
+inline bool is_culled(const Vec4* clip)
+{
+	return is_culled(clip_space_det(clip[0].x, clip[0].y, clip[0].w, clip[1].x, clip[1].y, clip[1].w,
+		clip[2].x, clip[2].y, clip[2].w));
+}
+
+inline int64_t to_fixed(float v)
+{
+	return (int64_t)std::floor(v * SUBPIXEL_ONE + 0.5f);
+}
+
+// pixels whose sample point (the integer pixel coordinate) can be covered by the triangle
+inline void pixel_bounds(const Vec3* v, int& x_min, int& y_min, int& x_max, int& y_max)
+{
+	int64_t fx[3], fy[3];
+	for (int k = 0; k < 3; k++) {
+		fx[k] = to_fixed(v[k].x);
+		fy[k] = to_fixed(v[k].y);
+	}
+	x_min = (int)((std::min(fx[0], std::min(fx[1], fx[2])) + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS);
+	y_min = (int)((std::min(fy[0], std::min(fy[1], fy[2])) + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS);
+	x_max = (int)(std::max(fx[0], std::max(fx[1], fx[2])) >> SUBPIXEL_BITS);
+	y_max = (int)(std::max(fy[0], std::max(fy[1], fy[2])) >> SUBPIXEL_BITS);
+}
+
+// triangle setup: per-vertex attributes and interpolation planes of the triangle about to be rasterized
+inline void bind_triangle(payload_t& payload, const raster_tri_t& t)
+{
+	for (int k = 0; k < 3; k++) {
+		payload.clip[k] = t.clip[k];
+		payload.world[k] = t.world[k];
+		payload.normal[k] = t.normal[k];
+		payload.uv[k] = t.uv[k];
+	}
+	payload.interp.setup(payload.clip, payload.world, payload.normal, payload.uv);
+}
+
+// vertex shading, clipping and assembly of one face, appends its front facing triangles to `out`
+void assemble_face(IShader& shader, int nface, std::vector<raster_tri_t>& out);
+// geometry pass of draw_mesh: assemble all faces in ordered chunks and bin them into tiles_x * tiles_y tiles
+void assemble_mesh(IShader& shader, int nfaces, int tiles_x, int tiles_y, std::vector<geometry_chunk_t>& chunks);
+
+// per-worker copy of a shader, of the same static type
+template<typename S>
+S* clone_shader(const S& shader) { return new S(shader); }
+inline IShader* clone_shader(const IShader& shader) { return shader.clone(); }
+
+// half-space rasterization of a screen space triangle inside the scissor rectangle. Vertices are snapped
+// to fixed point, the edge functions are stepped with integer adds and shared edges follow the top-left rule.
+// Pixels are visited in 2x4 blocks which are depth tested and shaded 8 lanes at a time.
+// S is the shader type, for a final shader class fragment() and fragment8() are bound statically
+// and can be inlined into the block loop.
+// The pre-pass modes take an owner buffer of one id per pixel: RASTER_DEPTH_ONLY stores id where the
+// triangle wins the depth test, RASTER_SHADE_EQUAL shades where owner still holds id.
+template<typename S>
+void rasterize(const Vec3* v, S& shader, float* zbuffer, TGAImage& image, const rect_t& scissor,
+	raster_mode mode = RASTER_SHADE, uint32_t* owner = nullptr, uint32_t id = 0) {
+
+	int width = image.get_width();
+	int k;
+
+	int64_t fx[3], fy[3];
+	for (k = 0; k < 3; k++) {
+		fx[k] = to_fixed(v[k].x);
+		fy[k] = to_fixed(v[k].y);
+	}
+
+	// twice the signed area, walk the vertices counter-clockwise
+	int64_t area = (fx[1] - fx[0]) * (fy[2] - fy[0]) - (fy[1] - fy[0]) * (fx[2] - fx[0]);
+	if (area == 0)
+		return;
+	int order[3] = { 0, 1, 2 };
+	if (area < 0) {
+		std::swap(order[1], order[2]);
+		area = -area;
+	}
+
+	//bounding box
+	int x_min, y_min, x_max, y_max;
+	pixel_bounds(v, x_min, y_min, x_max, y_max);
+	x_min = std::max(x_min, scissor.x0);
+	y_min = std::max(y_min, scissor.y0);
+	x_max = std::min(x_max, scissor.x1 - 1);
+	y_max = std::min(y_max, scissor.y1 - 1);
+	if (x_min > x_max || y_min > y_max)
+		return;
+
+	// blocks of 2x4 pixels, aligned to even x and y multiple of 4 so that quads line up across
+	// triangles and never straddle a tile
+	int bx_min = x_min & ~1;
+	int by_min = y_min & ~3;
+
+	// edge m runs from order[m + 1] to order[m + 2], its function is the weight of vertex order[m]:
+	// e(x, y) = a * x + b * y + c, evaluated at the first block and stepped per block.
+	// off holds the offsets of the 8 lanes within a block.
+	int64_t step_x[3], step_y[3], e_col[3], bias[3], off[3][8];
+	for (k = 0; k < 3; k++) {
+		int p = order[(k + 1) % 3], q = order[(k + 2) % 3];
+		int64_t a = fy[p] - fy[q];
+		int64_t b = fx[q] - fx[p];
+		int64_t c = -(a * fx[p] + b * fy[p]);
+		step_x[k] = a * SUBPIXEL_ONE;
+		step_y[k] = b * SUBPIXEL_ONE;
+		e_col[k] = a * ((int64_t)bx_min * SUBPIXEL_ONE) + b * ((int64_t)by_min * SUBPIXEL_ONE) + c;
+		for (int l = 0; l < 8; l++)
+			off[k][l] = step_x[k] * (l >> 2) + step_y[k] * (l & 3);
+		// top-left rule: samples exactly on an edge belong to left and top edges only
+		bias[k] = (a > 0 || (a == 0 && b < 0)) ? 0 : -1;
+	}
+
+	float inv_area = 1.f / (float)area;
+
+	for (int bx = bx_min; bx <= x_max; bx += 2) {
+		int64_t e_blk[3] = { e_col[0], e_col[1], e_col[2] };
+		for (int by = by_min; by <= y_max; by += 4) {
+			// coverage mask of the block
+			int covered = 0;
+			for (int l = 0; l < 8; l++) {
+				int x = bx + (l >> 2), y = by + (l & 3);
+				bool inside = ((e_blk[0] + off[0][l] + bias[0]) | (e_blk[1] + off[1][l] + bias[1]) |
+					(e_blk[2] + off[2][l] + bias[2])) >= 0;
+				if (inside && x >= x_min && x <= x_max && y >= y_min && y <= y_max)
+					covered |= 1 << l;
+			}
+
+			if (covered) {
+				float w[3][8];
+				for (k = 0; k < 3; k++)
+					for (int l = 0; l < 8; l++)
+						w[order[k]][l] = (float)(e_blk[k] + off[k][l]) * inv_area;
+				float8 bar[3] = { float8::load(w[0]), float8::load(w[1]), float8::load(w[2]) };
+
+				//screen z is affine in screen space, so depth does not depend on how a polygon was split.
+				//shader attributes are interpolated through payload.interp
+				float8 z = bar[0] * v[0].z + bar[1] * v[1].z + bar[2] * v[2].z;
+				float zl[8];
+				z.store(zl);
+
+				// depth test, lanes that pass are shaded together
+				int mask = 0;
+				for (int l = 0; l < 8; l++) {
+					if (!(covered >> l & 1))
+						continue;
+					int i = bx + (l >> 2), j = by + (l & 3);
+					int idx = i * width + j;
+
+					if (shader.late_depth_test) {
+						TGAColor color;
+						shader.payload.frag_depth = zl[l];
+						if (!shader.fragment(Vec3(w[0][l], w[1][l], w[2][l]), color) &&
+							shader.payload.frag_depth > zbuffer[idx]) {
+							zbuffer[idx] = shader.payload.frag_depth;
+							image.set(i, j, TGAColor(color.r, color.g, color.b));
+						}
+					}
+					else if (mode == RASTER_DEPTH_ONLY) {
+						if (zl[l] > zbuffer[idx]) {
+							zbuffer[idx] = zl[l];
+							owner[idx] = id;
+						}
+					}
+					else if (mode == RASTER_SHADE_EQUAL ? owner[idx] == id : zl[l] > zbuffer[idx]) {
+						mask |= 1 << l;
+					}
+				}
+
+				if (mask) {
+					TGAColor color[8];
+					int written = shader.fragment8(bar, mask, color);
+					for (int l = 0; l < 8; l++) {
+						if (!(written >> l & 1))
+							continue;
+						int i = bx + (l >> 2), j = by + (l & 3);
+						if (mode == RASTER_SHADE)
+							zbuffer[i * width + j] = zl[l];
+						image.set(i, j, TGAColor(color[l].r, color[l].g, color[l].b));
+					}
+				}
+			}
+
+			for (k = 0; k < 3; k++)
+				e_blk[k] += 4 * step_y[k];
+		}
+		for (k = 0; k < 3; k++)
+			e_col[k] += 2 * step_x[k];
+	}
+
+}
+
+template<typename S>
+void triangle(Vec4* verts, S& shader, float* zbuffer, TGAImage& image) {
+
+	//backface clip
+	if (is_culled(verts))
+		return;
+
+	Vec3 v[3];
+	for (int i = 0; i < 3; i++)
+		v[i] = v4tov3(shader.Viewport * verts[i]);
+
+	payload_t& p = shader.payload;
+	p.interp.setup(p.clip, p.world, p.normal, p.uv);
+	rect_t screen = { 0, 0, image.get_width(), image.get_height() };
+	rasterize(v, shader, zbuffer, image, screen);
+}
+
+template<typename S>
+void draw_triangles(TGAImage& image, float* zbuffer, S& shader, int nface)
+{
+	std::vector<raster_tri_t> tris;
+	assemble_face(shader, nface, tris);
+
+	rect_t screen = { 0, 0, image.get_width(), image.get_height() };
+	for (const raster_tri_t& t : tris) {
+		bind_triangle(shader.payload, t);
+		rasterize(t.screen, shader, zbuffer, image, screen);
+	}
+}
+
+// draw faces [0, nfaces) with tile-binned rasterization. Geometry is processed in ordered chunks, then
+// every TILE_SIZE x TILE_SIZE tile is shaded by one worker, which owns its pixels in zbuffer and image.
+// Triangles within a tile keep submission order, so the result matches drawing the faces one by one.
+// With RenderState.depth_prepass each tile is rasterized twice, depth only and then shading. The
+// pre-pass records which triangle won each pixel, so coplanar overlaps are resolved like without it
+// (first submitted wins) and every visible pixel is shaded once. Shaders with late_depth_test or
+// may_discard are drawn without the pre-pass.
+template<typename S>
+void draw_mesh(TGAImage& image, float* zbuffer, S& shader, int nfaces)
+{
+	int width = image.get_width();
+	int height = image.get_height();
+	int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+	int tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+	int ntiles = tiles_x * tiles_y;
+
+	std::vector<geometry_chunk_t> chunks;
+	assemble_mesh(shader, nfaces, tiles_x, tiles_y, chunks);
+
+	// triangle ids per pixel start at 1 in every tile, 0 is left where an earlier draw stays in front
+	bool prepass = RenderState.depth_prepass && !shader.late_depth_test && !shader.may_discard;
+	std::vector<uint32_t> owner(prepass ? (size_t)width * height : 0, 0);
+
+	parallel_for(0, ntiles, 1, [&](int begin, int end) {
+		std::unique_ptr<S> local(clone_shader(shader));
+		for (int tile = begin; tile < end; tile++) {
+			rect_t r;
+			r.x0 = tile % tiles_x * TILE_SIZE;
+			r.y0 = tile / tiles_x * TILE_SIZE;
+			r.x1 = std::min(r.x0 + TILE_SIZE, width);
+			r.y1 = std::min(r.y0 + TILE_SIZE, height);
+
+			uint32_t id = 0;
+			if (prepass) {
+				for (const geometry_chunk_t& chunk : chunks)
+					for (uint32_t t : chunk.bins[tile])
+						rasterize(chunk.tris[t].screen, *local, zbuffer, image, r, RASTER_DEPTH_ONLY, owner.data(), ++id);
+			}
+
+			id = 0;
+			for (const geometry_chunk_t& chunk : chunks) {
+				for (uint32_t t : chunk.bins[tile]) {
+					bind_triangle(local->payload, chunk.tris[t]);
+					rasterize(chunk.tris[t].screen, *local, zbuffer, image, r, prepass ? RASTER_SHADE_EQUAL : RASTER_SHADE,
+						owner.data(), ++id);
+				}
+			}
+		}
+	});
+}
@@ -1,19 +1,11 @@
 #include "sample.h"
 
-Vec3 texture_sample(Vec2 uv, TGAImage* image)
+Vec3 texture_sample(Vec2 uv, const Texture* image)
 {
-	uv[0] = fmod(uv[0], 1);
-	uv[1] = fmod(uv[1], 1);
-	int uv0 = uv[0] * image->get_width();
-	int uv1 = uv[1] * image->get_height();
-	TGAColor c = image->get(uv0, uv1);
-	Vec3 res;
-	for (int i = 0; i < 3; i++)
-		res[2 - i] = (float)c[i] / 255.f;
-	return res;
+	return image->sample(uv);
 }
 
-static int cal_cubemap_uv(Vec3 direction, Vec2& uv)
+int cal_cubemap_uv(Vec3 direction, Vec2& uv)
 {
 	int face_index = -1;
 	float ma = 0, sc = 0, tc = 0;
@@ -74,12 +66,95 @@ static int cal_cubemap_uv(Vec3 direction, Vec2& uv)
 	return face_index;
 }
 
-Vec3 cubemap_sampling(Vec3 direction, cubemap_t* cubemap)
+// real SH basis of bands 0 to 2 for a unit direction
+static void sh9_basis(Vec3 d, float* y)
 {
-	Vec2 uv;
-	Vec3 color;
-	int face_index = cal_cubemap_uv(direction, uv);
-	color = texture_sample(uv, cubemap->faces[face_index]);
+	y[0] = 0.282095f;
+	y[1] = 0.488603f * d.y;
+	y[2] = 0.488603f * d.z;
+	y[3] = 0.488603f * d.x;
+	y[4] = 1.092548f * d.x * d.y;
+	y[5] = 1.092548f * d.y * d.z;
+	y[6] = 0.315392f * (3 * d.z * d.z - 1);
+	y[7] = 1.092548f * d.x * d.z;
+	y[8] = 0.546274f * (d.x * d.x - d.y * d.y);
+}
+
+Vec3 cubemap_direction(int face_index, float sc, float tc)
+{
+	switch (face_index)
+	{
+	case 0: return Vec3(1, tc, sc);
+	case 1: return Vec3(-1, tc, -sc);
+	case 2: return Vec3(sc, 1, tc);
+	case 3: return Vec3(sc, -1, -tc);
+	case 4: return Vec3(-sc, tc, 1);
+	default: return Vec3(sc, tc, -1);
+	}
+}
+
+void sh9_project(const Cubemap* cubemap, Vec3* sh)
+{
+	for (int i = 0; i < 9; i++)
+		sh[i] = Vec3(0, 0, 0);
+
+	float total_weight = 0;
+	for (int f = 0; f < 6; f++)
+	{
+		int width = cubemap->face_size(0), height = width;
+		for (int y = 0; y < height; y++)
+			for (int x = 0; x < width; x++)
+			{
+				float sc = (x + 0.5f) / width * 2 - 1;
+				float tc = (y + 0.5f) / height * 2 - 1;
+				// solid angle of the texel, up to the constant texel area normalized away below
+				float r2 = 1 + sc * sc + tc * tc;
+				float weight = 1 / (r2 * sqrtf(r2));
+				Vec3 dir = cubemap_direction(f, sc, tc) / sqrtf(r2);
+
+				texel_t t = cubemap->texel_at(f, x, y);
+				Vec3 radiance(Texture::unorm8[t[0]], Texture::unorm8[t[1]], Texture::unorm8[t[2]]);
+				radiance = cwise_product(radiance, radiance);
 
-	return color;
-}
\ No newline at end of file
+				float basis[9];
+				sh9_basis(dir, basis);
+				for (int i = 0; i < 9; i++)
+					sh[i] = sh[i] + radiance * (basis[i] * weight);
+				total_weight += weight;
+			}
+	}
+
+	float norm = 4 * (float)PI / total_weight;
+	for (int i = 0; i < 9; i++)
+		sh[i] = sh[i] * norm;
+}
+
+Vec3 sh9_irradiance(const Vec3* sh, Vec3 n)
+{
+	float basis[9];
+	sh9_basis(n, basis);
+	Vec3 e(0, 0, 0);
+	for (int i = 0; i < 9; i++)
+		e = e + sh[i] * basis[i];
+	// ringing can dip below zero opposite a bright light
+	return Vec3(std::max(e.x, 0.f), std::max(e.y, 0.f), std::max(e.z, 0.f));
+}
+
+Vec3x8 sh9_irradiance8(const Vec3* sh, const Vec3x8& n)
+{
+	float8 basis[9];
+	basis[0] = float8(0.282095f);
+	basis[1] = n.y * 0.488603f;
+	basis[2] = n.z * 0.488603f;
+	basis[3] = n.x * 0.488603f;
+	basis[4] = n.x * n.y * 1.092548f;
+	basis[5] = n.y * n.z * 1.092548f;
+	basis[6] = (n.z * n.z * 3.f - 1.f) * 0.315392f;
+	basis[7] = n.x * n.z * 1.092548f;
+	basis[8] = (n.x * n.x - n.y * n.y) * 0.546274f;
+
+	Vec3x8 e = Vec3x8(sh[0]) * basis[0];
+	for (int i = 1; i < 9; i++)
+		e = e + Vec3x8(sh[i]) * basis[i];
+	return Vec3x8(max8(e.x, 0.f), max8(e.y, 0.f), max8(e.z, 0.f));
+}
@@ -3,6 +3,16 @@
 #include "matrix.h"
 #include "graphic.h"
 
-Vec3 texture_sample(Vec2 uv, TGAImage* image);
+Vec3 texture_sample(Vec2 uv, const Texture* image);
 
-Vec3 cubemap_sampling(Vec3 direction, cubemap_t* cubemap);
\ No newline at end of file
+// face index and uv of a direction, faces are +x, -x, +y, -y, +z, -z
+int cal_cubemap_uv(Vec3 direction, Vec2& uv);
+// (not normalized) direction through face coordinates sc, tc in -1 ~ +1, the inverse of cal_cubemap_uv
+Vec3 cubemap_direction(int face_index, float sc, float tc);
+
+// irradiance as 9 spherical harmonics coefficients (bands 0 to 2) per rgb channel. The cubemap
+// texels store sqrt of the irradiance, sh9_project squares them and weights each by its solid angle
+void sh9_project(const Cubemap* cubemap, Vec3* sh);
+// linear irradiance for a unit normal, no squaring needed
+Vec3 sh9_irradiance(const Vec3* sh, Vec3 n);
+Vec3x8 sh9_irradiance8(const Vec3* sh, const Vec3x8& n);
@@ -0,0 +1,116 @@
+#pragma once
+
+// instruction set detection, SSE2 is the baseline on x64 (gcc/clang/msvc).
+// AVX2 paths also use FMA, which msvc enables together with /arch:AVX2
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+#define USE_AVX2 1
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE 1
+#endif
+
+#if defined(USE_AVX2) || defined(USE_SSE)
+#include <immintrin.h>
+#endif
+#include <cmath>
+#include "matrix.h"
+
+// 8 float lanes, used by the 8-wide fragment path
+#if defined(USE_AVX2)
+struct float8
+{
+	__m256 v;
+
+	float8() {}
+	float8(float f) : v(_mm256_set1_ps(f)) {}
+	float8(__m256 m) : v(m) {}
+
+	static float8 load(const float* p) { return _mm256_loadu_ps(p); }
+	void store(float* p) const { _mm256_storeu_ps(p, v); }
+};
+
+inline float8 operator+(const float8& a, const float8& b) { return _mm256_add_ps(a.v, b.v); }
+inline float8 operator-(const float8& a, const float8& b) { return _mm256_sub_ps(a.v, b.v); }
+inline float8 operator*(const float8& a, const float8& b) { return _mm256_mul_ps(a.v, b.v); }
+inline float8 operator/(const float8& a, const float8& b) { return _mm256_div_ps(a.v, b.v); }
+inline float8 min8(const float8& a, const float8& b) { return _mm256_min_ps(a.v, b.v); }
+inline float8 max8(const float8& a, const float8& b) { return _mm256_max_ps(a.v, b.v); }
+inline float8 sqrt8(const float8& a) { return _mm256_sqrt_ps(a.v); }
+inline float8 abs8(const float8& a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a.v); }
+inline float8 floor8(const float8& a) { return _mm256_floor_ps(a.v); }
+// lane masks, only meant as the first argument of select8
+inline float8 greater8(const float8& a, const float8& b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+// mask ? a : b per lane
+inline float8 select8(const float8& mask, const float8& a, const float8& b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+#else
+struct float8
+{
+	float v[8];
+
+	float8() {}
+	float8(float f) { for (int i = 0; i < 8; i++) v[i] = f; }
+
+	static float8 load(const float* p) { float8 r; for (int i = 0; i < 8; i++) r.v[i] = p[i]; return r; }
+	void store(float* p) const { for (int i = 0; i < 8; i++) p[i] = v[i]; }
+};
+
+#define FLOAT8_OP(name, expr) \
+	inline float8 name(const float8& a, const float8& b) { float8 r; for (int i = 0; i < 8; i++) r.v[i] = expr; return r; }
+FLOAT8_OP(operator+, a.v[i] + b.v[i])
+FLOAT8_OP(operator-, a.v[i] - b.v[i])
+FLOAT8_OP(operator*, a.v[i] * b.v[i])
+FLOAT8_OP(operator/, a.v[i] / b.v[i])
+FLOAT8_OP(min8, a.v[i] < b.v[i] ? a.v[i] : b.v[i])
+FLOAT8_OP(max8, a.v[i] > b.v[i] ? a.v[i] : b.v[i])
+#undef FLOAT8_OP
+inline float8 sqrt8(const float8& a) { float8 r; for (int i = 0; i < 8; i++) r.v[i] = std::sqrt(a.v[i]); return r; }
+inline float8 abs8(const float8& a) { float8 r; for (int i = 0; i < 8; i++) r.v[i] = std::fabs(a.v[i]); return r; }
+inline float8 floor8(const float8& a) { float8 r; for (int i = 0; i < 8; i++) r.v[i] = std::floor(a.v[i]); return r; }
+// lane masks as 1 or 0, only meant as the first argument of select8
+inline float8 greater8(const float8& a, const float8& b) { float8 r; for (int i = 0; i < 8; i++) r.v[i] = a.v[i] > b.v[i] ? 1.f : 0.f; return r; }
+// mask ? a : b per lane
+inline float8 select8(const float8& mask, const float8& a, const float8& b) { float8 r; for (int i = 0; i < 8; i++) r.v[i] = mask.v[i] != 0 ? a.v[i] : b.v[i]; return r; }
+#endif
+
+struct Vec2x8
+{
+	Vec2x8() {}
+	Vec2x8(const float8& _x, const float8& _y) : x(_x), y(_y) {}
+	float8 x, y;
+};
+
+struct Vec3x8
+{
+	Vec3x8() {}
+	Vec3x8(const float8& _x, const float8& _y, const float8& _z) : x(_x), y(_y), z(_z) {}
+	explicit Vec3x8(const Vec3& v) : x(v.x), y(v.y), z(v.z) {}
+	float8 x, y, z;
+};
+
+inline Vec3x8 operator+(const Vec3x8& a, const Vec3x8& b) { return Vec3x8(a.x + b.x, a.y + b.y, a.z + b.z); }
+inline Vec3x8 operator-(const Vec3x8& a, const Vec3x8& b) { return Vec3x8(a.x - b.x, a.y - b.y, a.z - b.z); }
+inline Vec3x8 operator*(const Vec3x8& a, const Vec3x8& b) { return Vec3x8(a.x * b.x, a.y * b.y, a.z * b.z); }
+inline Vec3x8 operator*(const Vec3x8& a, const float8& t) { return Vec3x8(a.x * t, a.y * t, a.z * t); }
+
+inline float8 dot8(const Vec3x8& a, const Vec3x8& b)
+{
+	return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline Vec3x8 normalize8(const Vec3x8& v)
+{
+	return v * (float8(1.f) / sqrt8(dot8(v, v)));
+}
+
+// 8 Vec3 to lanes
+inline Vec3x8 gather8(const Vec3* v)
+{
+	float x[8], y[8], z[8];
+	for (int l = 0; l < 8; l++) {
+		x[l] = v[l].x;
+		y[l] = v[l].y;
+		z[l] = v[l].z;
+	}
+	return Vec3x8(float8::load(x), float8::load(y), float8::load(z));
+}
@@ -0,0 +1,351 @@
+#include "texture.h"
+#include "simd.h"
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+
+float Texture::unorm8[256];
+
+static bool init_unorm8()
+{
+	for (int i = 0; i < 256; i++)
+		Texture::unorm8[i] = (float)i / 255.f;
+	return true;
+}
+
+static bool unorm8_ready = init_unorm8();
+
+static int next_pow2(int n)
+{
+	int p = 1;
+	while (p < n)
+		p <<= 1;
+	return p;
+}
+
+Texture::Texture() : max_level(0), log2_size(0), format(TEXTURE_RGBA8), block_bytes(0), data(nullptr), data_size(0)
+{
+}
+
+// lay out the chain, each level halves down to 1 in both directions. Returns the texel count.
+size_t Texture::lay_out(int w, int h, bool mipmaps)
+{
+	size_t offset = 0;
+	levels.clear();
+	for (;;)
+	{
+		mip_level_t m;
+		m.width = w;
+		m.height = h;
+		int tiles_x = w > TEXTURE_TILE ? w >> TEXTURE_TILE_SHIFT : 1;
+		int tiles_y = h > TEXTURE_TILE ? h >> TEXTURE_TILE_SHIFT : 1;
+		m.tile_row_shift = 0;
+		while ((1 << m.tile_row_shift) < tiles_x)
+			m.tile_row_shift++;
+		m.wrap_x = w - 1;
+		m.wrap_y = h - 1;
+		m.fwidth = (float)w;
+		m.fheight = (float)h;
+		m.offset = offset;
+		levels.push_back(m);
+		offset += (size_t)tiles_x * tiles_y * TEXTURE_TILE * TEXTURE_TILE;
+
+		if (!mipmaps || (w == 1 && h == 1))
+			break;
+		w = w > 1 ? w / 2 : 1;
+		h = h > 1 ? h / 2 : 1;
+	}
+	max_level = (int)levels.size() - 1;
+	log2_size = log2f((float)(std::max)(levels[0].width, levels[0].height));
+	return offset;
+}
+
+Texture::Texture(TGAImage& image, bool mipmaps, texture_format target) : Texture()
+{
+	int src_w = image.get_width();
+	int src_h = image.get_height();
+	int bpp = image.get_bytespp();
+	const unsigned char* src = image.buffer();
+
+	size_t count = lay_out(next_pow2(src_w > 0 ? src_w : 1), next_pow2(src_h > 0 ? src_h : 1), mipmaps);
+	texels.assign(count * 4, 0);
+
+	if (!src || src_w <= 0 || src_h <= 0) {
+		encode(target);
+		return;
+	}
+
+	const mip_level_t& base = levels[0];
+	for (int y = 0; y < base.height; y++) {
+		int sy = (int)((long long)y * src_h / base.height);
+		for (int x = 0; x < base.width; x++) {
+			int sx = (int)((long long)x * src_w / base.width);
+			const unsigned char* p = src + ((size_t)sy * src_w + sx) * bpp;
+			uint8_t* t = &texels[texel_index(base, x, y) * 4];
+			if (bpp == 1) {
+				t[0] = t[1] = t[2] = p[0];
+				t[3] = 255;
+			}
+			else {
+				// tga stores b, g, r(, a)
+				t[0] = p[2];
+				t[1] = p[1];
+				t[2] = p[0];
+				t[3] = bpp == 4 ? p[3] : 255;
+			}
+		}
+	}
+
+	for (int i = 1; i <= max_level; i++)
+		build_mip(levels[i - 1], levels[i]);
+	encode(target);
+}
+
+// 2x2 box filter, a source dimension of 1 repeats its single row or column
+void Texture::build_mip(const mip_level_t& src, const mip_level_t& dst)
+{
+	int step_x = src.width > 1 ? 1 : 0;
+	int step_y = src.height > 1 ? 1 : 0;
+	for (int y = 0; y < dst.height; y++) {
+		int y0 = y << step_y, y1 = y0 + step_y;
+		for (int x = 0; x < dst.width; x++) {
+			int x0 = x << step_x, x1 = x0 + step_x;
+			const uint8_t* a = &texels[texel_index(src, x0, y0) * 4];
+			const uint8_t* b = &texels[texel_index(src, x1, y0) * 4];
+			const uint8_t* c = &texels[texel_index(src, x0, y1) * 4];
+			const uint8_t* d = &texels[texel_index(src, x1, y1) * 4];
+			uint8_t* out = &texels[texel_index(dst, x, y) * 4];
+			for (int i = 0; i < 4; i++)
+				out[i] = (uint8_t)((a[i] + b[i] + c[i] + d[i] + 2) >> 2);
+		}
+	}
+}
+
+// BC1 and BC4 palette entries as weights of the two endpoints,
+// value = (w0 * e0 + w1 * e1 + add) * recip >> 16, recip is 65536 / divisor rounded up, which is
+// exact for 8 bit endpoints
+typedef struct
+{
+	uint16_t w0, w1, add, recip;
+} block_weight_t;
+
+// [c0 > c1][index], 4 colors, or 3 colors and transparent black
+static const block_weight_t bc1_weights[2][4] = {
+	{ { 2, 0, 0, 32768 }, { 0, 2, 0, 32768 }, { 1, 1, 0, 32768 }, { 0, 0, 0, 0 } },
+	{ { 3, 0, 0, 21846 }, { 0, 3, 0, 21846 }, { 2, 1, 0, 21846 }, { 1, 2, 0, 21846 } }
+};
+
+// [e0 > e1][index], 8 values, or 6 values and 0, 255
+static const block_weight_t bc4_weights[2][8] = {
+	{ { 5, 0, 0, 13108 }, { 0, 5, 0, 13108 }, { 4, 1, 0, 13108 }, { 3, 2, 0, 13108 },
+	  { 2, 3, 0, 13108 }, { 1, 4, 0, 13108 }, { 0, 0, 0, 13108 }, { 0, 0, 1275, 13108 } },
+	{ { 7, 0, 0, 9363 }, { 0, 7, 0, 9363 }, { 6, 1, 0, 9363 }, { 5, 2, 0, 9363 },
+	  { 4, 3, 0, 9363 }, { 3, 4, 0, 9363 }, { 2, 5, 0, 9363 }, { 1, 6, 0, 9363 } }
+};
+
+static uint16_t pack565(const int* rgb)
+{
+	int r = (rgb[0] * 31 + 127) / 255, g = (rgb[1] * 63 + 127) / 255, b = (rgb[2] * 31 + 127) / 255;
+	return (uint16_t)(r << 11 | g << 5 | b);
+}
+
+// r, g, b, a = 255 packed from the low byte up
+static uint32_t unpack565(uint16_t c)
+{
+	uint32_t r = c >> 11 & 31, g = c >> 5 & 63, b = c & 31;
+	return (r << 3 | r >> 2) | (g << 2 | g >> 4) << 8 | (b << 3 | b >> 2) << 16 | 0xff000000u;
+}
+
+static texel_t bc1_decode(const uint8_t* block, int i)
+{
+	uint16_t c0 = (uint16_t)(block[0] | block[1] << 8), c1 = (uint16_t)(block[2] | block[3] << 8);
+	uint32_t bits = block[4] | block[5] << 8 | block[6] << 16 | (uint32_t)block[7] << 24;
+	const block_weight_t& w = bc1_weights[c0 > c1][bits >> (2 * i) & 3];
+	uint32_t e0 = unpack565(c0), e1 = unpack565(c1);
+
+	texel_t t;
+#if defined(USE_SSE)
+	// r, g, b, a of both endpoints in 16 bit lanes, weighted and summed in one go
+	__m128i e = _mm_unpacklo_epi32(_mm_cvtsi32_si128((int)e0), _mm_cvtsi32_si128((int)e1));
+	__m128i v = _mm_unpacklo_epi8(e, _mm_setzero_si128());
+	v = _mm_mullo_epi16(v, _mm_set_epi16(w.w1, w.w1, w.w1, w.w1, w.w0, w.w0, w.w0, w.w0));
+	v = _mm_add_epi16(v, _mm_srli_si128(v, 8));
+	v = _mm_mulhi_epu16(v, _mm_set1_epi16((short)w.recip));
+	int packed = _mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+	memcpy(t.c, &packed, 4);
+#else
+	for (int c = 0; c < 4; c++)
+		t.c[c] = (uint8_t)((w.w0 * (e0 >> (8 * c) & 255) + w.w1 * (e1 >> (8 * c) & 255)) * w.recip >> 16);
+#endif
+	return t;
+}
+
+static uint8_t bc4_decode(const uint8_t* block, int i)
+{
+	uint64_t bits = 0;
+	for (int k = 7; k >= 2; k--)
+		bits = bits << 8 | block[k];
+	const block_weight_t& w = bc4_weights[block[0] > block[1]][bits >> (3 * i) & 7];
+	return (uint8_t)((w.w0 * block[0] + w.w1 * block[1] + w.add) * w.recip >> 16);
+}
+
+texel_t Texture::decode_texel(const uint8_t* block, int i) const
+{
+	texel_t t;
+	switch (format) {
+	case TEXTURE_BC1:
+		return bc1_decode(block, i);
+	case TEXTURE_BC4:
+		t.c[0] = t.c[1] = t.c[2] = bc4_decode(block, i);
+		t.c[3] = 255;
+		return t;
+	default: {
+		t.c[0] = bc4_decode(block, i);
+		t.c[1] = bc4_decode(block + 8, i);
+		// z of the unit normal, stored like x and y as 0 ~ 255 for -1 ~ +1
+		float x = unorm8[t.c[0]] * 2 - 1, y = unorm8[t.c[1]] * 2 - 1;
+		float z = sqrtf((std::max)(1 - x * x - y * y, 0.f));
+		t.c[2] = (uint8_t)(z * 127.5f + 128.f);
+		t.c[3] = 255;
+		return t;
+	}
+	}
+}
+
+// endpoints are the corners of the color bounding box, each texel takes the nearest palette entry
+static void bc1_encode(const uint8_t* rgba, uint8_t* block)
+{
+	int lo[3] = { 255, 255, 255 }, hi[3] = { 0, 0, 0 };
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 3; c++) {
+			lo[c] = (std::min)(lo[c], (int)rgba[i * 4 + c]);
+			hi[c] = (std::max)(hi[c], (int)rgba[i * 4 + c]);
+		}
+	// every field of hi is at least the one of lo, so c0 >= c1 and equal endpoints need no indices
+	uint16_t c0 = pack565(hi), c1 = pack565(lo);
+	uint32_t bits = 0;
+	if (c0 > c1) {
+		uint8_t palette[4][3];
+		uint32_t e0 = unpack565(c0), e1 = unpack565(c1);
+		for (int k = 0; k < 4; k++) {
+			const block_weight_t& w = bc1_weights[1][k];
+			for (int c = 0; c < 3; c++)
+				palette[k][c] = (uint8_t)((w.w0 * (e0 >> (8 * c) & 255) + w.w1 * (e1 >> (8 * c) & 255)) * w.recip >> 16);
+		}
+		for (int i = 0; i < 16; i++) {
+			int best = 0, best_d = INT32_MAX;
+			for (int k = 0; k < 4; k++) {
+				int d = 0;
+				for (int c = 0; c < 3; c++) {
+					int diff = rgba[i * 4 + c] - palette[k][c];
+					d += diff * diff;
+				}
+				if (d < best_d) {
+					best_d = d;
+					best = k;
+				}
+			}
+			bits |= (uint32_t)best << (2 * i);
+		}
+	}
+	block[0] = (uint8_t)c0;
+	block[1] = (uint8_t)(c0 >> 8);
+	block[2] = (uint8_t)c1;
+	block[3] = (uint8_t)(c1 >> 8);
+	for (int k = 0; k < 4; k++)
+		block[4 + k] = (uint8_t)(bits >> (8 * k));
+}
+
+// one channel of 16 rgba texels, endpoints are the range of the block in 8 value mode
+static void bc4_encode(const uint8_t* rgba, int channel, uint8_t* block)
+{
+	int lo = 255, hi = 0;
+	for (int i = 0; i < 16; i++) {
+		lo = (std::min)(lo, (int)rgba[i * 4 + channel]);
+		hi = (std::max)(hi, (int)rgba[i * 4 + channel]);
+	}
+	uint64_t bits = 0;
+	if (hi > lo) {
+		int palette[8];
+		for (int k = 0; k < 8; k++) {
+			const block_weight_t& w = bc4_weights[1][k];
+			palette[k] = (w.w0 * hi + w.w1 * lo) * w.recip >> 16;
+		}
+		for (int i = 0; i < 16; i++) {
+			int v = rgba[i * 4 + channel], best = 0;
+			for (int k = 1; k < 8; k++)
+				if (abs(v - palette[k]) < abs(v - palette[best]))
+					best = k;
+			bits |= (uint64_t)best << (3 * i);
+		}
+	}
+	block[0] = (uint8_t)hi;
+	block[1] = (uint8_t)lo;
+	for (int k = 0; k < 6; k++)
+		block[2 + k] = (uint8_t)(bits >> (8 * k));
+}
+
+// replace the RGBA8 levels with blocks, tile t of the texels becomes block t. Either way data
+// then points at the final storage.
+void Texture::encode(texture_format target)
+{
+	if (target == TEXTURE_RGBA8) {
+		data = texels.data();
+		data_size = texels.size();
+		return;
+	}
+	block_bytes = target == TEXTURE_BC5 ? 16 : 8;
+	std::vector<uint8_t> blocks(texels.size() / (TEXTURE_TILE * TEXTURE_TILE * 4) * block_bytes);
+	uint8_t tile[TEXTURE_TILE * TEXTURE_TILE * 4];
+	for (const mip_level_t& m : levels) {
+		int tiles_x = 1 << m.tile_row_shift;
+		int tiles_y = m.height > TEXTURE_TILE ? m.height >> TEXTURE_TILE_SHIFT : 1;
+		for (int ty = 0; ty < tiles_y; ty++)
+			for (int tx = 0; tx < tiles_x; tx++) {
+				// levels smaller than a tile repeat their texels across it
+				for (int i = 0; i < 16; i++) {
+					int x = (tx * TEXTURE_TILE + (i & 3)) & m.wrap_x;
+					int y = (ty * TEXTURE_TILE + (i >> 2)) & m.wrap_y;
+					memcpy(tile + i * 4, &texels[texel_index(m, x, y) * 4], 4);
+				}
+				uint8_t* block = &blocks[(texel_index(m, tx * TEXTURE_TILE, ty * TEXTURE_TILE) >> 4) * block_bytes];
+				if (target == TEXTURE_BC1)
+					bc1_encode(tile, block);
+				else if (target == TEXTURE_BC4)
+					bc4_encode(tile, 0, block);
+				else {
+					bc4_encode(tile, 0, block);
+					bc4_encode(tile, 1, block + 8);
+				}
+			}
+	}
+	texels.swap(blocks);
+	format = target;
+	data = texels.data();
+	data_size = texels.size();
+}
+
+Texture* Texture::from_file(const char* filename, bool mipmaps, texture_format format)
+{
+	TGAImage image;
+	image.read_tga_file(filename, true);
+	return new Texture(image, mipmaps, format);
+}
+
+Texture* Texture::view(int width, int height, bool mipmaps, texture_format format, const uint8_t* data, size_t size)
+{
+	if (width <= 0 || height <= 0 || (width & (width - 1)) || (height & (height - 1)))
+		return nullptr;
+	Texture* t = new Texture();
+	size_t count = t->lay_out(width, height, mipmaps);
+	t->format = format;
+	t->block_bytes = format == TEXTURE_RGBA8 ? 0 : format == TEXTURE_BC5 ? 16 : 8;
+	size_t expected = format == TEXTURE_RGBA8 ? count * 4 : count / (TEXTURE_TILE * TEXTURE_TILE) * t->block_bytes;
+	if (size != expected) {
+		delete t;
+		return nullptr;
+	}
+	t->data = data;
+	t->data_size = size;
+	return t;
+}
@@ -0,0 +1,153 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+#include "tgaimage.h"
+#include "matrix.h"
+
+// texels are stored in square tiles of 4x4, the 16 RGBA8 texels of a tile fill a 64 byte cache line
+#define TEXTURE_TILE_SHIFT 2
+#define TEXTURE_TILE (1 << TEXTURE_TILE_SHIFT)
+// uv lod that always selects the base level, for samples without screen-space derivatives
+#define TEXTURE_BASE_LOD -128.f
+
+// texel storage. The block formats keep one 4x4 tile per block and are decoded in the fetch:
+// BC1 is 565 color with 2 bit indices, BC4 one 8 bit channel with 3 bit indices (replicated to
+// r, g and b like grayscale images), BC5 two BC4 channels for r and g with b rebuilt as the z of
+// a unit normal
+typedef enum {
+	TEXTURE_RGBA8,
+	TEXTURE_BC1,
+	TEXTURE_BC4,
+	TEXTURE_BC5
+} texture_format;
+
+// one decoded texel, r, g, b, a
+typedef struct
+{
+	uint8_t c[4];
+	uint8_t operator[](int i) const { return c[i]; }
+} texel_t;
+
+// texture decoded once from a TGAImage into RGBA8 texels, tiled so that a fetch footprint in any
+// direction stays within a few cache lines. Tiles are in row order, levels smaller than a tile
+// take one whole tile.
+// Sizes are powers of two so that uv wrapping is a mask, images of other sizes are resampled
+// (nearest) up to the next power of two. Grayscale images are replicated to r, g and b.
+// With mipmaps the chain down to 1x1 is box filtered at load, every level stored in the same buffer.
+// A block format is encoded from the RGBA8 levels at load, which are then released.
+class Texture
+{
+public:
+	explicit Texture(TGAImage& image, bool mipmaps = false, texture_format format = TEXTURE_RGBA8);
+	// read a tga file, flipped so that v = 0 is the bottom row. A file that can not be read gives
+	// a black 1x1 texture, like sampling an empty TGAImage did.
+	static Texture* from_file(const char* filename, bool mipmaps = false, texture_format format = TEXTURE_RGBA8);
+	// a texture over size bytes laid out like texel_data() of one with the same base size, chain
+	// and format, which are not copied and must outlive it. nullptr when size does not match.
+	static Texture* view(int width, int height, bool mipmaps, texture_format format, const uint8_t* data, size_t size);
+
+	int get_width() const { return levels[0].width; }
+	int get_height() const { return levels[0].height; }
+	int mip_levels() const { return (int)levels.size(); }
+	texture_format get_format() const { return format; }
+	// resident bytes of all levels
+	size_t memory_size() const { return data_size; }
+	// the texels or blocks of all levels, memory_size() bytes
+	const uint8_t* texel_data() const { return data; }
+
+	// nearest level for a pixel footprint of 2^uv_lod in uv units, see quad_uv_lod8 in main.cpp
+	int mip_level(float uv_lod) const
+	{
+		float lod = uv_lod + log2_size;
+		if (!(lod > 0))
+			return 0;
+		if (lod >= max_level)
+			return max_level;
+		return (int)(lod + 0.5f);
+	}
+
+	// r, g, b, a of the nearest texel, uv wraps around
+	texel_t texel(Vec2 uv, int level = 0) const
+	{
+		const mip_level_t& m = levels[level];
+		int x = fast_floor(uv.x * m.fwidth) & m.wrap_x;
+		int y = fast_floor(uv.y * m.fheight) & m.wrap_y;
+		return fetch(texel_index(m, x, y));
+	}
+
+	// texel by integer coordinates, which must be inside the level
+	texel_t texel_at(int x, int y, int level = 0) const { return fetch(texel_index(levels[level], x, y)); }
+
+	Vec3 sample(Vec2 uv) const { return sample_lod(uv, TEXTURE_BASE_LOD); }
+
+	// one channel, 0 = r ... 3 = a
+	float sample(Vec2 uv, int channel) const { return unorm8[texel(uv)[channel]]; }
+
+	Vec3 sample_lod(Vec2 uv, float uv_lod) const
+	{
+		texel_t t = texel(uv, mip_level(uv_lod));
+		return Vec3(unorm8[t[0]], unorm8[t[1]], unorm8[t[2]]);
+	}
+
+	float sample_lod(Vec2 uv, float uv_lod, int channel) const
+	{
+		return unorm8[texel(uv, mip_level(uv_lod))[channel]];
+	}
+
+	// byte to [0, 1], filled before main
+	static float unorm8[256];
+
+private:
+	static int fast_floor(float v)
+	{
+		int i = (int)v;
+		return i - (v < (float)i);
+	}
+
+	typedef struct
+	{
+		int width, height;
+		int wrap_x, wrap_y;
+		float fwidth, fheight;
+		int tile_row_shift; // log2 of the tiles in a row
+		size_t offset; // first texel of the level in texels
+	} mip_level_t;
+
+	static size_t texel_index(const mip_level_t& m, int x, int y)
+	{
+		size_t tile = ((size_t)(y >> TEXTURE_TILE_SHIFT) << m.tile_row_shift) + (x >> TEXTURE_TILE_SHIFT);
+		int inner = ((y & (TEXTURE_TILE - 1)) << TEXTURE_TILE_SHIFT) + (x & (TEXTURE_TILE - 1));
+		return m.offset + (tile << (2 * TEXTURE_TILE_SHIFT)) + inner;
+	}
+
+	// texel index i is texel i % 16 of tile i / 16, and the block formats store tile t at block t
+	texel_t fetch(size_t index) const
+	{
+		if (format == TEXTURE_RGBA8)
+		{
+			texel_t t;
+			memcpy(t.c, &data[index * 4], 4);
+			return t;
+		}
+		return decode_texel(&data[(index >> 4) * block_bytes], (int)(index & 15));
+	}
+
+	Texture();
+	Texture(const Texture&);
+	Texture& operator=(const Texture&);
+	size_t lay_out(int width, int height, bool mipmaps);
+	texel_t decode_texel(const uint8_t* block, int i) const;
+	void build_mip(const mip_level_t& src, const mip_level_t& dst);
+	void encode(texture_format target);
+
+	std::vector<mip_level_t> levels;
+	int max_level;
+	float log2_size; // log2 of the larger base dimension
+	texture_format format;
+	int block_bytes; // bytes per 4x4 tile of a block format
+	std::vector<uint8_t> texels; // or blocks, empty for a view
+	const uint8_t* data; // texels, or the memory of a view
+	size_t data_size;
+};
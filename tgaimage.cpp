@@ -4,6 +4,7 @@
 #include <time.h>
 #include <math.h>
 #include "tgaimage.h"
+#include "mapped_file.h"
 
 TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0) {
 }
@@ -40,108 +41,129 @@ TGAImage & TGAImage::operator =(const TGAImage &img) {
 	return *this;
 }
 
-bool TGAImage::read_tga_file(const char *filename) {
+bool TGAImage::read_tga_file(const char *filename, bool bottom_up) {
 	if (data) delete [] data;
 	data = NULL;
-	std::ifstream in;
-	in.open (filename, std::ios::binary);
-	if (!in.is_open()) {
+	// the whole file is mapped and decoded from memory
+	MappedFile file(filename);
+	if (!file.is_open()) {
 		std::cerr << "can't open file " << filename << "\n";
-		in.close();
 		return false;
 	}
+	const unsigned char *in  = (const unsigned char *)file.data();
+	const unsigned char *end = in + file.size();
 	TGA_Header header;
-	in.read((char *)&header, sizeof(header));
-	if (!in.good()) {
-		in.close();
+	if (file.size() < sizeof(header)) {
 		std::cerr << "an error occured while reading the header\n";
 		return false;
 	}
+	memcpy(&header, in, sizeof(header));
+	// the image ID follows the header, in stays inside the file so end - in is the data left
+	if (file.size() < sizeof(header) + (unsigned char)header.idlength) {
+		std::cerr << "an error occured while reading the header\n";
+		return false;
+	}
+	in += sizeof(header) + (unsigned char)header.idlength;
 	width   = header.width;
 	height  = header.height;
 	bytespp = header.bitsperpixel>>3;
 	if (width<=0 || height<=0 || (bytespp!=GRAYSCALE && bytespp!=RGB && bytespp!=RGBA)) {
-		in.close();
 		std::cerr << "bad bpp (or width/height) value\n";
 		return false;
 	}
-	unsigned long nbytes = bytespp*width*height;
-	data = new unsigned char[nbytes];
-	if (3==header.datatypecode || 2==header.datatypecode) {
-		in.read((char *)data, nbytes);
-		if (!in.good()) {
-			in.close();
-			std::cerr << "an error occured while reading the data\n";
-			return false;
-		}
-	} else if (10==header.datatypecode||11==header.datatypecode) {
-		if (!load_rle_data(in)) {
-			in.close();
-			std::cerr << "an error occured while reading the data\n";
-			return false;
-		}
-	} else {
-		in.close();
+	// rows are stored from the bottom unless bit 5 of the descriptor is set, they are written
+	// straight to their place instead of flipping afterwards
+	bool top_first = (header.imagedescriptor & 0x20) != 0;
+	bool flip = top_first == bottom_up;
+	if (2!=header.datatypecode && 3!=header.datatypecode && 10!=header.datatypecode && 11!=header.datatypecode) {
 		std::cerr << "unknown file format " << (int)header.datatypecode << "\n";
 		return false;
 	}
-	if (!(header.imagedescriptor & 0x20)) {
-		flip_vertically();
+	unsigned long nbytes = bytespp*width*height;
+	data = new unsigned char[nbytes];
+	bool ok = header.datatypecode < 10 ? load_raw_data(in, end, flip) : load_rle_data(in, end, flip);
+	if (!ok) {
+		// no partly decoded image
+		std::cerr << "an error occured while reading the data\n";
+		delete [] data;
+		data = NULL;
+		return false;
 	}
 	if (header.imagedescriptor & 0x10) {
 		flip_horizontally();
 	}
-	std::cerr << width << "x" << height << "/" << bytespp*8 << "\n";
-	in.close();
+	// one write per line, images load on several threads
+	std::cerr << (std::to_string(width) + "x" + std::to_string(height) + "/" + std::to_string(bytespp * 8) + "\n");
 	return true;
 }
 
-bool TGAImage::load_rle_data(std::ifstream &in) {
-	unsigned long pixelcount = width*height;
-	unsigned long currentpixel = 0;
-	unsigned long currentbyte  = 0;
-	TGAColor colorbuffer;
-	do {
-		unsigned char chunkheader = 0;
-		chunkheader = in.get();
-		if (!in.good()) {
-			std::cerr << "an error occured while reading the data\n";
+bool TGAImage::load_raw_data(const unsigned char *in, const unsigned char *end, bool flip) {
+	size_t bytes_per_line = (size_t)width*bytespp;
+	if ((size_t)(end - in) < bytes_per_line*height)
+		return false;
+	if (!flip) {
+		memcpy(data, in, bytes_per_line*height);
+		return true;
+	}
+	for (int j=0; j<height; j++)
+		memcpy(data + (height-1-j)*bytes_per_line, in + j*bytes_per_line, bytes_per_line);
+	return true;
+}
+
+// n copies of one pixel, doubling the copied span each step
+static void fill_pixels(unsigned char *dst, const unsigned char *pixel, int bytespp, int n) {
+	if (bytespp==1) {
+		memset(dst, pixel[0], n);
+		return;
+	}
+	size_t total = (size_t)n*bytespp;
+	size_t done  = bytespp;
+	memcpy(dst, pixel, bytespp);
+	while (done < total) {
+		size_t k = done < total - done ? done : total - done;
+		memcpy(dst + done, dst, k);
+		done += k;
+	}
+}
+
+// each packet is copied or filled in spans that end at a row, a packet may run over several rows
+bool TGAImage::load_rle_data(const unsigned char *in, const unsigned char *end, bool flip) {
+	size_t bytes_per_line = (size_t)width*bytespp;
+	int row = 0;
+	size_t col = 0;
+	while (row < height) {
+		if (in >= end)
 			return false;
-		}
-		if (chunkheader<128) {
-			chunkheader++;
-			for (int i=0; i<chunkheader; i++) {
-				in.read((char *)colorbuffer.raw, bytespp);
-				if (!in.good()) {
-					std::cerr << "an error occured while reading the header\n";
-					return false;
-				}
-				for (int t=0; t<bytespp; t++)
-					data[currentbyte++] = colorbuffer.raw[t];
-				currentpixel++;
-				if (currentpixel>pixelcount) {
-					std::cerr << "Too many pixels read\n";
-					return false;
-				}
-			}
-		} else {
-			chunkheader -= 127;
-			in.read((char *)colorbuffer.raw, bytespp);
-			if (!in.good()) {
-				std::cerr << "an error occured while reading the header\n";
+		unsigned char chunkheader = *in++;
+		bool run  = chunkheader >= 128;
+		int count = (chunkheader & 127) + 1;
+		size_t packet_bytes = run ? bytespp : (size_t)count*bytespp;
+		if ((size_t)(end - in) < packet_bytes)
+			return false;
+		const unsigned char *src = in;
+		in += packet_bytes;
+		while (count > 0) {
+			if (row >= height) {
+				std::cerr << "Too many pixels read\n";
 				return false;
 			}
-			for (int i=0; i<chunkheader; i++) {
-				for (int t=0; t<bytespp; t++)
-					data[currentbyte++] = colorbuffer.raw[t];
-				currentpixel++;
-				if (currentpixel>pixelcount) {
-					std::cerr << "Too many pixels read\n";
-					return false;
-				}
+			unsigned char *dst = data + (size_t)(flip ? height-1-row : row)*bytes_per_line + col;
+			int n = (int)((bytes_per_line - col)/bytespp);
+			if (n > count) n = count;
+			if (run) {
+				fill_pixels(dst, src, bytespp, n);
+			} else {
+				memcpy(dst, src, (size_t)n*bytespp);
+				src += (size_t)n*bytespp;
+			}
+			count -= n;
+			col += (size_t)n*bytespp;
+			if (col == bytes_per_line) {
+				col = 0;
+				row++;
 			}
 		}
-	} while (currentpixel < pixelcount);
+	}
 	return true;
 }
 
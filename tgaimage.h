@@ -67,7 +67,8 @@ protected:
 	int height;
 	int bytespp;
 
-	bool   load_rle_data(std::ifstream &in);
+	bool   load_raw_data(const unsigned char *in, const unsigned char *end, bool flip);
+	bool   load_rle_data(const unsigned char *in, const unsigned char *end, bool flip);
 	bool unload_rle_data(std::ofstream &out);
 public:
 	enum Format {
@@ -77,7 +78,9 @@ public:
 	TGAImage();
 	TGAImage(int w, int h, int bpp);
 	TGAImage(const TGAImage &img);
-	bool read_tga_file(const char *filename);
+	// rows go to the buffer from the top, or from the bottom with bottom_up, whatever the origin
+	// the file was stored with
+	bool read_tga_file(const char *filename, bool bottom_up=false);
 	bool write_tga_file(const char *filename, bool rle=true);
 	bool flip_horizontally();
 	bool flip_vertically();